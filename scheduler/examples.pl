@@ -7,11 +7,17 @@ for $file (<examples/*>){
 	if( $file =~ /proc(\d+)-c(\d+)-(\w+)\.out/){
 	#	print "Proc $1 CORE $2 Proc $3\n";
 		`./simulator -c $2 -s $3 examples/proc$1.csv | tail -7 > output1`;
-		`tail -7 $file > output2`;
+		`tail -7 $file | tr -d '\\r' > output2`;
 		$diff = `diff output1 output2`;
 		if($diff){
 			print "Test file $file differs\n$diff";
 		}
+		`./simulator -c $2 -s $3 examples/proc$1.csv | tail -n +2 > output1`;
+		`./simulator -S -c $2 -s $3 examples/proc$1.csv | tail -n +2 > output2`;
+		$diff = `diff output1 output2`;
+		if($diff){
+			print "Streamed run of $file differs\n$diff";
+		}
 	}
 }
 #cleanup
@@ -0,0 +1,95 @@
+/*
+ * Converts a CSV job trace into the binary trace format read by the
+ * simulator (see libtrace.h), so replaying it skips parsing text.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "libtrace/libtrace.h"
+
+
+void print_usage(char *program_name)
+{
+	fprintf(stderr, "Usage: %s [-d] <input csv> <output trace>\n", program_name);
+	fprintf(stderr, "       %s examples/proc1.csv proc1.trace\n", program_name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "  -d  store each arrival time as the difference from the previous one.\n");
+}
+
+
+int main(int argc, char **argv)
+{
+	int c;
+	unsigned flags = 0;
+
+	while ((c = getopt(argc, argv, "d")) != -1)
+	{
+		switch (c)
+		{
+			case 'd':
+				flags |= TRACE_DELTA_ARRIVALS;
+				break;
+
+			default:
+				print_usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (optind != argc - 2)
+	{
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	char *input_name = argv[optind];
+	char *output_name = argv[optind + 1];
+
+	trace_job_t *jobs;
+	trace_error_t error;
+	int count;
+
+	switch (trace_load_csv(input_name, &jobs, &count, &error))
+	{
+		case TRACE_OK:
+			break;
+
+		case TRACE_OPEN_FAILED:
+			fprintf(stderr, "Unable to open file \"%s\".\n", input_name);
+			return 2;
+
+		case TRACE_BAD_FORMAT:
+			if (error.line > 0)
+				fprintf(stderr, "Illegal file format on line %d of \"%s\": %s.\n", error.line, input_name, error.reason);
+			else
+				fprintf(stderr, "Illegal file format in \"%s\": %s.\n", input_name, error.reason);
+			return 2;
+
+		default:
+			fprintf(stderr, "Out of memory.\n");
+			return 2;
+	}
+
+	FILE *output = fopen(output_name, "wb");
+	if (output == NULL)
+	{
+		fprintf(stderr, "Unable to open file \"%s\".\n", output_name);
+		free(jobs);
+		return 2;
+	}
+
+	int result = trace_write_binary(output, jobs, count, flags);
+	if (fclose(output) != 0 || result != TRACE_OK)
+	{
+		fprintf(stderr, "Unable to write file \"%s\".\n", output_name);
+		free(jobs);
+		return 2;
+	}
+
+	printf("Wrote %d job(s) to \"%s\".\n", count, output_name);
+
+	free(jobs);
+	return 0;
+}
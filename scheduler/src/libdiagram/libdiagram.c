@@ -0,0 +1,177 @@
+/** @file libdiagram.c
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "libdiagram.h"
+
+#define DIAGRAM_MIN_SEGMENTS 16
+
+
+/**
+  Initializes an empty timing diagram.
+
+  @param d a pointer to an instance of the diagram_t data structure
+  @param cores number of cores whose history is recorded
+ */
+void diagram_init(diagram_t *d, int cores)
+{
+  d->cores = cores;
+  d->segments = calloc(cores, sizeof(diagram_segment_t*));
+  d->segment_counts = calloc(cores, sizeof(int));
+  d->segment_capacities = calloc(cores, sizeof(int));
+}
+
+
+/**
+  Records that a core spent the next units time units on a job. When it was
+  already running that job the last segment is simply lengthened.
+
+  @param d a pointer to an instance of the diagram_t data structure
+  @param core_id the core that ran
+  @param job_id the job it ran, or DIAGRAM_IDLE
+  @param units how many time units it ran for
+  @return 0 on success, -1 if memory ran out
+ */
+int diagram_append(diagram_t *d, int core_id, int job_id, int units)
+{
+  int count = d->segment_counts[core_id];
+  diagram_segment_t* last = (count > 0) ? &d->segments[core_id][count - 1] : NULL;
+
+  if (units <= 0)
+    return 0;
+
+  if (last != NULL && last->job_id == job_id)
+  {
+    last->length += units;
+    return 0;
+  }
+
+  if (count == d->segment_capacities[core_id])
+  {
+    int capacity = (count == 0) ? DIAGRAM_MIN_SEGMENTS : 2 * count;
+    diagram_segment_t* grown = realloc(d->segments[core_id], capacity * sizeof(diagram_segment_t));
+    if (grown == NULL)
+      return -1;
+
+    d->segments[core_id] = grown;
+    d->segment_capacities[core_id] = capacity;
+    last = (count > 0) ? &grown[count - 1] : NULL;
+  }
+
+  diagram_segment_t* segment = &d->segments[core_id][count];
+  segment->job_id = job_id;
+  segment->start = (last != NULL) ? last->start + last->length : 0;
+  segment->length = units;
+  d->segment_counts[core_id]++;
+  return 0;
+}
+
+
+/**
+  Gives read access to the history of one core.
+
+  @param d a pointer to an instance of the diagram_t data structure
+  @param core_id the core to look at
+  @param segments set to that core's segments, oldest first
+  @return the number of segments
+ */
+int diagram_segments(diagram_t *d, int core_id, const diagram_segment_t **segments)
+{
+  *segments = d->segments[core_id];
+  return d->segment_counts[core_id];
+}
+
+
+/**
+  Writes the symbol a job is drawn with: 0-9, then a-z, then A-Z, then the
+  job id in parentheses. Idle time is drawn as '-'.
+
+  @param job_id the job to draw, or DIAGRAM_IDLE
+  @param symbol at least DIAGRAM_SYMBOL_SIZE bytes to write the NUL terminated symbol into
+  @return the length of the symbol
+ */
+int diagram_symbol(int job_id, char *symbol)
+{
+  if (job_id == DIAGRAM_IDLE)
+    return sprintf(symbol, "-");
+  else if (job_id < 10)
+    return sprintf(symbol, "%d", job_id);
+  else if (job_id < 10 + 26)
+    return sprintf(symbol, "%c", job_id - 10 + 'a');
+  else if (job_id < 10 + 26 + 26)
+    return sprintf(symbol, "%c", job_id - 10 - 26 + 'A');
+
+  int length = snprintf(symbol, 10, "(%d)", job_id); //Very large ids are cut to 9 characters.
+  return (length < 10) ? length : 9;
+}
+
+
+/**
+  Renders the history of one core as text, one symbol per time unit (see
+  diagram_symbol()).
+
+  @param d a pointer to an instance of the diagram_t data structure
+  @param core_id the core to render
+  @param out where to write it
+ */
+void diagram_print(diagram_t *d, int core_id, FILE *out)
+{
+  char symbol[DIAGRAM_SYMBOL_SIZE];
+
+  for (int i = 0; i < d->segment_counts[core_id]; i++)
+  {
+    const diagram_segment_t* segment = &d->segments[core_id][i];
+    int length = diagram_symbol(segment->job_id, symbol);
+
+    if (length == 1)
+    {
+      for (int j = 0; j < segment->length; j++)
+        putc(symbol[0], out);
+    }
+    else
+    {
+      for (int j = 0; j < segment->length; j++)
+        fwrite(symbol, 1, length, out);
+    }
+  }
+}
+
+
+/**
+  Writes every segment as CSV for other tools, one line per segment with a
+  header line first: core, job (-1 when idle), start and length.
+
+  @param d a pointer to an instance of the diagram_t data structure
+  @param out where to write it
+ */
+void diagram_dump(diagram_t *d, FILE *out)
+{
+  fprintf(out, "core,job,start,length\n");
+
+  for (int i = 0; i < d->cores; i++)
+  {
+    for (int j = 0; j < d->segment_counts[i]; j++)
+    {
+      const diagram_segment_t* segment = &d->segments[i][j];
+      fprintf(out, "%d,%d,%d,%d\n", i, segment->job_id, segment->start, segment->length);
+    }
+  }
+}
+
+
+/**
+  Frees all the memory held by the diagram.
+
+  @param d a pointer to an instance of the diagram_t data structure
+ */
+void diagram_destroy(diagram_t *d)
+{
+  for (int i = 0; i < d->cores; i++)
+    free(d->segments[i]);
+
+  free(d->segments);
+  free(d->segment_counts);
+  free(d->segment_capacities);
+}
@@ -0,0 +1,44 @@
+/** @file libdiagram.h
+ */
+
+#ifndef LIBDIAGRAM_H_
+#define LIBDIAGRAM_H_
+
+#include <stdio.h>
+
+/**
+  One stretch of time during which a core ran the same job, or sat idle.
+*/
+typedef struct _diagram_segment_t
+{
+  int job_id; //Job that ran, DIAGRAM_IDLE while the core had nothing to run.
+  int start; //First time unit of the stretch.
+  int length; //Number of time units it lasted.
+} diagram_segment_t;
+
+#define DIAGRAM_IDLE -1
+#define DIAGRAM_SYMBOL_SIZE 11 //Room needed by diagram_symbol().
+
+/**
+  Timing diagram kept as run-length segments per core, so its size follows
+  the number of context switches instead of cores times elapsed time. The
+  text form is only produced when asked for, see diagram_print().
+*/
+typedef struct _diagram_t
+{
+  int cores;
+  diagram_segment_t** segments; //segments[core_id] holds that core's history, oldest first.
+  int* segment_counts;
+  int* segment_capacities;
+} diagram_t;
+
+
+void diagram_init    (diagram_t *d, int cores);
+int  diagram_append  (diagram_t *d, int core_id, int job_id, int units);
+int  diagram_segments(diagram_t *d, int core_id, const diagram_segment_t **segments);
+int  diagram_symbol  (int job_id, char *symbol);
+void diagram_print   (diagram_t *d, int core_id, FILE *out);
+void diagram_dump    (diagram_t *d, FILE *out);
+void diagram_destroy (diagram_t *d);
+
+#endif /* LIBDIAGRAM_H_ */
@@ -0,0 +1,158 @@
+/** @file libhistogram.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "libhistogram.h"
+
+
+/*
+  Bucket of a value. Above the exact range, the power of two the value falls
+  in picks a group of HISTOGRAM_HALF_COUNT buckets and the bits just below its
+  highest one pick the bucket within it.
+*/
+static int bucket_of(long long value)
+{
+  if (value < HISTOGRAM_SUB_COUNT)
+    return (int)value;
+
+  int shift = (63 - __builtin_clzll((unsigned long long)value)) - (HISTOGRAM_SUB_BITS - 1);
+  int top = (int)(value >> shift);
+  return HISTOGRAM_SUB_COUNT + (shift - 1) * HISTOGRAM_HALF_COUNT + (top - HISTOGRAM_HALF_COUNT);
+}
+
+/*
+  Largest value that lands in a bucket.
+*/
+static long long bucket_highest(int bucket)
+{
+  if (bucket < HISTOGRAM_SUB_COUNT)
+    return bucket;
+
+  int shift = (bucket - HISTOGRAM_SUB_COUNT) / HISTOGRAM_HALF_COUNT + 1;
+  long long top = HISTOGRAM_HALF_COUNT + (bucket - HISTOGRAM_SUB_COUNT) % HISTOGRAM_HALF_COUNT;
+  return (top << shift) + ((1LL << shift) - 1);
+}
+
+
+/**
+  Initializes an empty histogram.
+
+  @param h a pointer to an instance of the histogram_t data structure
+ */
+void histogram_init(histogram_t *h)
+{
+  memset(h, 0, sizeof(histogram_t));
+}
+
+
+/**
+  Records one value. O(1).
+
+  @param h a pointer to an instance of the histogram_t data structure
+  @param value the value; a negative one is recorded as 0
+ */
+void histogram_record(histogram_t *h, long long value)
+{
+  if (value < 0)
+    value = 0;
+
+  h->counts[bucket_of(value)]++;
+  h->count++;
+  h->sum += value;
+  if (value > h->max)
+    h->max = value;
+}
+
+
+/**
+  Adds every value recorded in one histogram to another, e.g. to combine
+  the results of several runs.
+
+  @param into the histogram that receives the values
+  @param from the histogram they are read from, left unchanged
+ */
+void histogram_merge(histogram_t *into, const histogram_t *from)
+{
+  int i;
+
+  for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+    into->counts[i] += from->counts[i];
+  into->count += from->count;
+  into->sum += from->sum;
+  if (from->max > into->max)
+    into->max = from->max;
+}
+
+
+/**
+  Returns the value at a percentile: at least that share of the recorded
+  values are no larger than it. It is the largest value of the bucket the
+  percentile falls in, never above the largest value recorded.
+
+  @param h a pointer to an instance of the histogram_t data structure
+  @param percentile from 0 to 100, e.g. 99.9
+  @return the value at the percentile, 0 if nothing was recorded
+ */
+long long histogram_percentile(const histogram_t *h, double percentile)
+{
+  if (h->count == 0)
+    return 0;
+
+  long long rank = (long long)(percentile / 100.0 * h->count);
+  if ((double)rank < percentile / 100.0 * h->count)
+    rank++;
+  if (rank < 1)
+    rank = 1;
+
+  long long seen = 0;
+  int i;
+  for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+  {
+    seen += h->counts[i];
+    if (seen >= rank)
+    {
+      long long highest = bucket_highest(i);
+      return (highest < h->max) ? highest : h->max;
+    }
+  }
+
+  return h->max;
+}
+
+
+/**
+  Returns the number of values recorded.
+
+  @param h a pointer to an instance of the histogram_t data structure
+  @return the number of values recorded
+ */
+long long histogram_count(const histogram_t *h)
+{
+  return h->count;
+}
+
+
+/**
+  Returns the sum of the values recorded.
+
+  @param h a pointer to an instance of the histogram_t data structure
+  @return the sum of the values recorded
+ */
+long long histogram_sum(const histogram_t *h)
+{
+  return h->sum;
+}
+
+
+/**
+  Returns the largest value recorded.
+
+  @param h a pointer to an instance of the histogram_t data structure
+  @return the largest value recorded, 0 if nothing was
+ */
+long long histogram_max(const histogram_t *h)
+{
+  return h->max;
+}
@@ -0,0 +1,37 @@
+/** @file libhistogram.h
+ */
+
+#ifndef LIBHISTOGRAM_H_
+#define LIBHISTOGRAM_H_
+
+#define HISTOGRAM_SUB_BITS 7
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_HALF_COUNT (HISTOGRAM_SUB_COUNT / 2)
+//Exact buckets below HISTOGRAM_SUB_COUNT, then HISTOGRAM_HALF_COUNT per power of two up to 2^63.
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_COUNT + (63 - HISTOGRAM_SUB_BITS) * HISTOGRAM_HALF_COUNT)
+
+/**
+  Log-bucketed histogram of non-negative values, in the style of HDR
+  histograms. Values below HISTOGRAM_SUB_COUNT get a bucket each; above that
+  every power of two is split into HISTOGRAM_HALF_COUNT buckets, so a value
+  read back from a percentile is never more than 1/HISTOGRAM_HALF_COUNT above
+  the true one. Memory is fixed and recording is O(1).
+*/
+typedef struct _histogram_t
+{
+  long long counts[HISTOGRAM_BUCKETS];
+  long long count; //Values recorded.
+  long long sum; //Their total, for the mean.
+  long long max; //Largest value recorded, exact.
+} histogram_t;
+
+
+void      histogram_init      (histogram_t *h);
+void      histogram_record    (histogram_t *h, long long value);
+void      histogram_merge     (histogram_t *into, const histogram_t *from);
+long long histogram_percentile(const histogram_t *h, double percentile);
+long long histogram_count     (const histogram_t *h);
+long long histogram_sum       (const histogram_t *h);
+long long histogram_max       (const histogram_t *h);
+
+#endif /* LIBHISTOGRAM_H_ */
@@ -3,6 +3,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
 
 #include "libpriqueue.h"
 
@@ -18,9 +19,814 @@
   See also @ref comparer-page
  */
 void priqueue_init(priqueue_t *q, int(*comparer)(const void *, const void *))
+{
+  priqueue_init_backend(q, comparer, PRIQUEUE_LIST);
+}
+
+
+/**
+  Initializes the priqueue_t data structure on top of the given backend.
+  Every other priqueue_* function behaves the same no matter which backend is
+  picked, only their cost changes.
+
+  @param q a pointer to an instance of the priqueue_t data structure
+  @param comparer a function pointer that compares two elements.
+  See also @ref comparer-page
+  @param backend the storage to use, see priqueue_backend_t
+ */
+void priqueue_init_backend(priqueue_t *q, int(*comparer)(const void *, const void *), priqueue_backend_t backend)
 {
   q->first = NULL;
   q->comp = comparer;
+  q->backend = backend;
+  q->heap = NULL;
+  q->size = 0;
+  q->heap_capacity = 0;
+  q->heap_keys = NULL;
+  q->heap_orders = NULL;
+  q->next_order = 0;
+  q->free_nodes = NULL;
+  q->slabs = NULL;
+  q->slab_nodes = PRIQUEUE_SLAB_MIN_NODES;
+  q->nodes_in_use = 0;
+  q->nodes_high_water = 0;
+  q->nodes_capacity = 0;
+  q->intrusive = 0;
+  q->link_offset = 0;
+  q->key = NULL;
+  q->buckets = NULL;
+  q->bucket_bits = NULL;
+  q->bucket_count = 0;
+  q->key_min = 0;
+  q->key_max = 0;
+  q->typed = NULL;
+}
+
+
+/**
+  Gives the queue a function that maps every element to an integer key
+  that orders elements the same way the comparer does: a smaller key for
+  every element that should come out first. Required by PRIQUEUE_BUCKET,
+  which indexes its buckets directly by this key, and PRIQUEUE_KEYED_HEAP,
+  which caches it next to each node. Must be called before the
+  first element is offered.
+
+  @param q a pointer to an instance of the priqueue_t data structure
+  @param key returns the key of an element
+ */
+void priqueue_set_key(priqueue_t *q, int(*key)(const void *))
+{
+  q->key = key;
+}
+
+
+/**
+  Initializes the priqueue_t data structure in intrusive mode. Instead of
+  wrapping every offered element in a node of its own, the queue links
+  elements through a priqueue_link_t member embedded in them, so offering,
+  polling and removing never allocate. priqueue_remove() also becomes O(1)
+  for PRIQUEUE_LIST and PRIQUEUE_BUCKET and O(log n) for the heaps.
+
+  Assumptions
+    - Every element offered contains a priqueue_link_t at link_offset.
+    - An element is in at most one queue through a given link at a time.
+
+  @param q a pointer to an instance of the priqueue_t data structure
+  @param comparer a function pointer that compares two elements.
+  See also @ref comparer-page
+  @param backend the storage to use, see priqueue_backend_t
+  @param link_offset offsetof() the priqueue_link_t member inside the element
+ */
+void priqueue_init_intrusive(priqueue_t *q, int(*comparer)(const void *, const void *), priqueue_backend_t backend, size_t link_offset)
+{
+  priqueue_init_backend(q, comparer, backend);
+  q->intrusive = 1;
+  q->link_offset = link_offset;
+}
+
+
+/**
+  Installs a specialization generated by PRIQUEUE_DEFINE_TYPED(). Its comparer
+  and key replace the queue's own, and the heap sifts and list scan run the
+  inlined versions. Must be called before the first element is offered.
+
+  @param q a pointer to an instance of the priqueue_t data structure
+  @param typed the name##_typed descriptor of the specialization
+ */
+void priqueue_set_typed(priqueue_t *q, const priqueue_typed_t *typed)
+{
+  q->typed = typed;
+  q->comp = typed->compare;
+  q->key = typed->key;
+}
+
+
+/*
+  Node allocator. Nodes are carved out of slabs that only go back to the
+  system in priqueue_destroy(); in between, released nodes are chained through
+  their next pointer on q->free_nodes and handed out again first. Returns
+  NULL when a new slab is needed and memory runs out.
+*/
+static Node* node_alloc(priqueue_t *q)
+{
+  if (q->free_nodes == NULL)
+  {
+    int count = q->slab_nodes;
+    priqueue_slab_t* slab = malloc(sizeof(priqueue_slab_t) + count * sizeof(Node));
+    if (slab == NULL)
+    {
+      return NULL;
+    }
+    slab->next = q->slabs;
+    q->slabs = slab;
+    for (int i = count - 1; i >= 0; i--)
+    {
+      slab->nodes[i].next = q->free_nodes;
+      q->free_nodes = &slab->nodes[i];
+    }
+    q->nodes_capacity += count;
+    if (q->slab_nodes < PRIQUEUE_SLAB_MAX_NODES)
+    {
+      q->slab_nodes *= 2;
+    }
+  }
+
+  Node* node = q->free_nodes;
+  q->free_nodes = node->next;
+  q->nodes_in_use++;
+  if (q->nodes_in_use > q->nodes_high_water)
+  {
+    q->nodes_high_water = q->nodes_in_use;
+  }
+  return node;
+}
+
+static void node_free(priqueue_t *q, Node* node)
+{
+  node->ptr = NULL;
+  node->next = q->free_nodes;
+  q->free_nodes = node;
+  q->nodes_in_use--;
+}
+
+//The node that carries ptr: its embedded link in intrusive mode, a fresh slab node otherwise (NULL if out of memory).
+static Node* node_acquire(priqueue_t *q, void *ptr)
+{
+  Node* node = q->intrusive ? (Node*)((char*)ptr + q->link_offset) : node_alloc(q);
+  if (node == NULL)
+  {
+    return NULL;
+  }
+  node->next = NULL;
+  node->prev = NULL;
+  node->ptr = ptr;
+  node->owner = q;
+  return node;
+}
+
+//Called once a node has left the queue for good.
+static void node_release(priqueue_t *q, Node* node)
+{
+  node->owner = NULL;
+  if (!q->intrusive)
+  {
+    node_free(q, node);
+  }
+}
+
+//Unhooks a node from the sorted list in O(1) using its back link.
+static void list_unlink(priqueue_t *q, Node* node)
+{
+  if (node->prev == NULL)
+  {
+    q->first = node->next;
+  }
+  else
+  {
+    node->prev->next = node->next;
+  }
+  if (node->next != NULL)
+  {
+    node->next->prev = node->prev;
+  }
+  q->size--;
+}
+
+
+/*
+  Ties on the comparer are broken by insertion order so both backends hand out
+  equal elements first in, first out.
+*/
+static int node_before(priqueue_t *q, Node* a, Node* b)
+{
+  int comp_value = q->comp(a->ptr, b->ptr);
+  if (comp_value != 0)
+  {
+    return comp_value < 0;
+  }
+  return a->order < b->order;
+}
+
+//Both heap backends share the node array; PRIQUEUE_KEYED_HEAP adds the key arrays.
+static int is_heap(priqueue_t *q)
+{
+  return q->backend == PRIQUEUE_HEAP || q->backend == PRIQUEUE_KEYED_HEAP;
+}
+
+/*
+  Keyed heap helpers. Slot i of the heap is spread over heap[i], heap_keys[i]
+  and heap_orders[i]; sifting compares only the two key arrays and never
+  follows a node or element pointer.
+*/
+//Whether (key, order) comes out before what sits in slot.
+static int keyed_before(priqueue_t *q, int key, unsigned long order, int slot)
+{
+  if (key != q->heap_keys[slot])
+  {
+    return key < q->heap_keys[slot];
+  }
+  return order < q->heap_orders[slot];
+}
+
+//Copies slot from into slot to.
+static void keyed_move(priqueue_t *q, int to, int from)
+{
+  q->heap[to] = q->heap[from];
+  q->heap_keys[to] = q->heap_keys[from];
+  q->heap_orders[to] = q->heap_orders[from];
+  q->heap[to]->index = to;
+}
+
+static void keyed_sift_up(priqueue_t *q, int index)
+{
+  Node* moving = q->heap[index];
+  int key = q->heap_keys[index];
+  unsigned long order = q->heap_orders[index];
+  while (index > 0)
+  {
+    int parent = (index - 1) / 2;
+    if (!keyed_before(q, key, order, parent))
+    {
+      break;
+    }
+    keyed_move(q, index, parent);
+    index = parent;
+  }
+  q->heap[index] = moving;
+  q->heap_keys[index] = key;
+  q->heap_orders[index] = order;
+  moving->index = index;
+}
+
+static void keyed_sift_down(priqueue_t *q, int size, int index)
+{
+  Node* moving = q->heap[index];
+  int key = q->heap_keys[index];
+  unsigned long order = q->heap_orders[index];
+  while (1)
+  {
+    int child = 2 * index + 1;
+    if (child >= size)
+    {
+      break;
+    }
+    if (child + 1 < size && keyed_before(q, q->heap_keys[child + 1], q->heap_orders[child + 1], child))
+    {
+      child++;
+    }
+    if (keyed_before(q, key, order, child))
+    {
+      break;
+    }
+    keyed_move(q, index, child);
+    index = child;
+  }
+  q->heap[index] = moving;
+  q->heap_keys[index] = key;
+  q->heap_orders[index] = order;
+  moving->index = index;
+}
+
+//Stores node in slot index. Only the live heap records positions, scratch copies do not.
+static void heap_place(priqueue_t *q, Node** heap, int index, Node* node)
+{
+  heap[index] = node;
+  if (heap == q->heap)
+  {
+    node->index = index;
+  }
+}
+
+static void heap_sift_up(priqueue_t *q, Node** heap, int index)
+{
+  if (q->backend == PRIQUEUE_KEYED_HEAP && heap == q->heap)
+  {
+    keyed_sift_up(q, index);
+    return;
+  }
+  if (q->typed != NULL && heap == q->heap)
+  {
+    q->typed->sift_up(heap, index);
+    return;
+  }
+  Node* moving = heap[index];
+  while (index > 0)
+  {
+    int parent = (index - 1) / 2;
+    if (!node_before(q, moving, heap[parent]))
+    {
+      break;
+    }
+    heap_place(q, heap, index, heap[parent]);
+    index = parent;
+  }
+  heap_place(q, heap, index, moving);
+}
+
+static void heap_sift_down(priqueue_t *q, Node** heap, int size, int index)
+{
+  if (q->backend == PRIQUEUE_KEYED_HEAP && heap == q->heap)
+  {
+    keyed_sift_down(q, size, index);
+    return;
+  }
+  if (q->typed != NULL && heap == q->heap)
+  {
+    q->typed->sift_down(heap, size, index);
+    return;
+  }
+  Node* moving = heap[index];
+  while (1)
+  {
+    int child = 2 * index + 1;
+    if (child >= size)
+    {
+      break;
+    }
+    if (child + 1 < size && node_before(q, heap[child + 1], heap[child]))
+    {
+      child++;
+    }
+    if (!node_before(q, heap[child], moving))
+    {
+      break;
+    }
+    heap_place(q, heap, index, heap[child]);
+    index = child;
+  }
+  heap_place(q, heap, index, moving);
+}
+
+//Moves slot from of the live heap into slot to, keys included.
+static void heap_move(priqueue_t *q, int to, int from)
+{
+  if (q->backend == PRIQUEUE_KEYED_HEAP)
+  {
+    keyed_move(q, to, from);
+  }
+  else
+  {
+    heap_place(q, q->heap, to, q->heap[from]);
+  }
+}
+
+//Takes the node at position index out of the heap and returns it.
+static Node* heap_take(priqueue_t *q, int index)
+{
+  Node* taken = q->heap[index];
+  q->size--;
+  if (index != q->size)
+  {
+    heap_move(q, index, q->size);
+    heap_sift_down(q, q->heap, q->size, index);
+    heap_sift_up(q, q->heap, index);
+  }
+  return taken;
+}
+
+//Returns the node that would be polled index'th, or NULL. Pops a scratch copy of the heap.
+static Node* heap_select(priqueue_t *q, int index)
+{
+  if (index < 0 || index >= q->size)
+  {
+    return NULL;
+  }
+  if (index == 0)
+  {
+    return q->heap[0];
+  }
+
+  int size = q->size;
+  Node** scratch = malloc(size * sizeof(Node*));
+  for (int i = 0; i < size; i++)
+  {
+    scratch[i] = q->heap[i];
+  }
+  for (int i = 0; i < index; i++)
+  {
+    size--;
+    scratch[0] = scratch[size];
+    heap_sift_down(q, scratch, size, 0);
+  }
+  Node* selected = scratch[0];
+  free(scratch);
+  return selected;
+}
+
+
+/*
+  Bucket helpers. Bucket k & (bucket_count - 1) holds the elements with key k
+  in FIFO order, and bit k & (bucket_count - 1) of bucket_bits says whether it
+  is non-empty. Live keys always lie in [key_min, key_min + bucket_count), so
+  the array is used as a ring and a key never shares a bucket with another
+  one. key_min is exactly the smallest live key, which makes peek and poll
+  O(1); key_max is only an upper bound on the largest one. Nodes keep their
+  key in index.
+*/
+#define BUCKET_WORD_BITS 64
+
+static void bucket_set(priqueue_t *q, int slot, int on)
+{
+  unsigned long long bit = 1ULL << (slot % BUCKET_WORD_BITS);
+  if (on)
+  {
+    q->bucket_bits[slot / BUCKET_WORD_BITS] |= bit;
+  }
+  else
+  {
+    q->bucket_bits[slot / BUCKET_WORD_BITS] &= ~bit;
+  }
+}
+
+//Returns the smallest live key in [from, limit), or limit if there is none.
+static long long bucket_find(priqueue_t *q, long long from, long long limit)
+{
+  int mask = q->bucket_count - 1;
+  while (from < limit)
+  {
+    int slot = (int)(from & mask);
+    unsigned long long word = q->bucket_bits[slot / BUCKET_WORD_BITS] >> (slot % BUCKET_WORD_BITS);
+    if (word != 0)
+    {
+      long long found = from + __builtin_ctzll(word);
+      return (found < limit) ? found : limit;
+    }
+    from += BUCKET_WORD_BITS - (slot % BUCKET_WORD_BITS);
+  }
+  return limit;
+}
+
+static Node* bucket_first(priqueue_t *q)
+{
+  return (q->size == 0) ? NULL : q->buckets[q->key_min & (q->bucket_count - 1)].head;
+}
+
+//The node polled right after node, or NULL.
+static Node* bucket_after(priqueue_t *q, Node* node)
+{
+  if (node->next != NULL)
+  {
+    return node->next;
+  }
+  long long limit = (long long)q->key_min + q->bucket_count;
+  long long key = bucket_find(q, (long long)node->index + 1, limit);
+  return (key == limit) ? NULL : q->buckets[key & (q->bucket_count - 1)].head;
+}
+
+//Appends a node to its bucket, behind every node offered before it.
+static void bucket_link(priqueue_t *q, Node* node)
+{
+  int slot = node->index & (q->bucket_count - 1);
+  priqueue_bucket_t* bucket = &q->buckets[slot];
+  Node* previous_node = bucket->tail;
+  while (previous_node != NULL && previous_node->order > node->order)
+  {
+    previous_node = previous_node->prev;
+  }
+  node->prev = previous_node;
+  node->next = (previous_node == NULL) ? bucket->head : previous_node->next;
+  if (previous_node == NULL)
+  {
+    bucket->head = node;
+  }
+  else
+  {
+    previous_node->next = node;
+  }
+  if (node->next == NULL)
+  {
+    bucket->tail = node;
+  }
+  else
+  {
+    node->next->prev = node;
+  }
+  bucket_set(q, slot, 1);
+}
+
+//Doubles the ring until keys from low to high fit, then deals the nodes out again. -1 if out of memory.
+static int bucket_grow(priqueue_t *q, long long low, long long high)
+{
+  int old_count = q->bucket_count;
+  priqueue_bucket_t* old_buckets = q->buckets;
+
+  size_t count = (old_count == 0) ? BUCKET_WORD_BITS : (size_t)old_count;
+  while ((unsigned long long)(high - low) >= count && count < PRIQUEUE_BUCKET_MAX_COUNT)
+  {
+    count *= 2;
+  }
+  if (count == (size_t)old_count)
+  {
+    return 0;
+  }
+
+  priqueue_bucket_t* buckets = calloc(count, sizeof(priqueue_bucket_t));
+  unsigned long long* bits = calloc(count / BUCKET_WORD_BITS, sizeof(unsigned long long));
+  if (buckets == NULL || bits == NULL)
+  {
+    free(buckets);
+    free(bits);
+    return -1;
+  }
+  q->bucket_count = (int)count;
+  q->buckets = buckets;
+  free(q->bucket_bits);
+  q->bucket_bits = bits;
+
+  for (int i = 0; i < old_count; i++)
+  {
+    Node* node = old_buckets[i].head;
+    while (node != NULL)
+    {
+      Node* next_node = node->next;
+      bucket_link(q, node);
+      node = next_node;
+    }
+  }
+  free(old_buckets);
+  return 0;
+}
+
+static int bucket_insert(priqueue_t *q, Node* node)
+{
+  int key = q->key(node->ptr);
+  node->index = key;
+
+  if (q->size == 0)
+  {
+    q->key_min = key;
+    q->key_max = key;
+  }
+  long long low = (key < q->key_min) ? key : q->key_min;
+  long long high = (key > q->key_max) ? key : q->key_max;
+  if (high - low >= q->bucket_count && bucket_grow(q, low, high) != 0)
+  {
+    return -1;
+  }
+  q->key_min = (int)low;
+  q->key_max = (int)high;
+
+  bucket_link(q, node);
+  q->size++;
+  return 0;
+}
+
+static void bucket_unlink(priqueue_t *q, Node* node)
+{
+  int slot = node->index & (q->bucket_count - 1);
+  priqueue_bucket_t* bucket = &q->buckets[slot];
+  if (node->prev == NULL)
+  {
+    bucket->head = node->next;
+  }
+  else
+  {
+    node->prev->next = node->next;
+  }
+  if (node->next == NULL)
+  {
+    bucket->tail = node->prev;
+  }
+  else
+  {
+    node->next->prev = node->prev;
+  }
+  q->size--;
+
+  if (bucket->head == NULL)
+  {
+    bucket_set(q, slot, 0);
+    if (q->size == 0)
+    {
+      q->key_max = q->key_min;
+    }
+    else if (node->index == q->key_min)
+    {
+      q->key_min = (int)bucket_find(q, (long long)q->key_min + 1, (long long)q->key_min + q->bucket_count);
+    }
+  }
+}
+
+
+//First node in poll order for the chained backends (PRIQUEUE_LIST, PRIQUEUE_BUCKET).
+static Node* chain_first(priqueue_t *q)
+{
+  return (q->backend == PRIQUEUE_BUCKET) ? bucket_first(q) : q->first;
+}
+
+//Node polled right after node for the chained backends.
+static Node* chain_after(priqueue_t *q, Node* node)
+{
+  return (q->backend == PRIQUEUE_BUCKET) ? bucket_after(q, node) : node->next;
+}
+
+//Takes a node out of the queue, whichever backend holds it.
+static void node_unlink(priqueue_t *q, Node* node)
+{
+  if (is_heap(q))
+  {
+    heap_take(q, node->index);
+  }
+  else if (q->backend == PRIQUEUE_BUCKET)
+  {
+    bucket_unlink(q, node);
+  }
+  else
+  {
+    list_unlink(q, node);
+  }
+}
+
+//Grows the heap arrays to hold at least needed nodes. -1 if out of memory, with the queue unchanged.
+static int heap_reserve(priqueue_t *q, int needed)
+{
+  if (needed <= q->heap_capacity)
+  {
+    return 0;
+  }
+  int capacity = q->heap_capacity;
+  while (capacity < needed)
+  {
+    capacity = (capacity == 0) ? 16 : capacity * 2;
+  }
+  Node** heap = realloc(q->heap, capacity * sizeof(Node*));
+  if (heap == NULL)
+  {
+    return -1;
+  }
+  q->heap = heap;
+  if (q->backend == PRIQUEUE_KEYED_HEAP)
+  {
+    int* keys = realloc(q->heap_keys, capacity * sizeof(int));
+    if (keys == NULL)
+    {
+      return -1;
+    }
+    q->heap_keys = keys;
+    unsigned long* orders = realloc(q->heap_orders, capacity * sizeof(unsigned long));
+    if (orders == NULL)
+    {
+      return -1;
+    }
+    q->heap_orders = orders;
+  }
+  q->heap_capacity = capacity;
+  return 0;
+}
+
+//Puts a node in the first free slot of the heap without restoring the heap order.
+static void heap_append(priqueue_t *q, Node* node)
+{
+  q->heap[q->size] = node;
+  node->index = q->size;
+  if (q->backend == PRIQUEUE_KEYED_HEAP)
+  {
+    q->heap_keys[q->size] = q->key(node->ptr);
+    q->heap_orders[q->size] = node->order;
+  }
+}
+
+//Whether the ring can hold one more node with the given key without passing PRIQUEUE_BUCKET_MAX_COUNT.
+static int bucket_fits(priqueue_t *q, int key)
+{
+  if (q->size == 0)
+  {
+    return 1;
+  }
+  long long low = (key < q->key_min) ? key : q->key_min;
+  long long high = (key > q->key_max) ? key : q->key_max;
+  return high - low < PRIQUEUE_BUCKET_MAX_COUNT;
+}
+
+/*
+  Moves every node of a PRIQUEUE_BUCKET queue into a PRIQUEUE_KEYED_HEAP,
+  keeping their offer orders, so the elements still come out as before.
+  Returns -1, leaving the queue as it was, if memory runs out.
+*/
+static int bucket_to_heap(priqueue_t *q)
+{
+  int count = q->size;
+  priqueue_bucket_t* old_buckets = q->buckets;
+  int old_count = q->bucket_count;
+
+  q->backend = PRIQUEUE_KEYED_HEAP;
+  if (heap_reserve(q, count) != 0)
+  {
+    q->backend = PRIQUEUE_BUCKET;
+    return -1;
+  }
+  q->size = 0;
+  for (int i = 0; i < old_count; i++)
+  {
+    for (Node* node = old_buckets[i].head; node != NULL; node = node->next)
+    {
+      heap_append(q, node);
+      q->size++;
+    }
+  }
+  for (int i = q->size / 2 - 1; i >= 0; i--)
+  {
+    heap_sift_down(q, q->heap, q->size, i);
+  }
+
+  free(old_buckets);
+  free(q->bucket_bits);
+  q->buckets = NULL;
+  q->bucket_bits = NULL;
+  q->bucket_count = 0;
+  q->key_min = 0;
+  q->key_max = 0;
+  return 0;
+}
+
+//Links a node into the queue and returns its index (see priqueue_offer()), or -1 if out of memory.
+static int node_insert(priqueue_t *q, Node* to_insert)
+{
+  if (q->backend == PRIQUEUE_BUCKET && !bucket_fits(q, q->key(to_insert->ptr)) && bucket_to_heap(q) != 0)
+  {
+    return -1;
+  }
+
+  if (q->backend == PRIQUEUE_BUCKET)
+  {
+    if (bucket_insert(q, to_insert) != 0)
+    {
+      return -1;
+    }
+    return (bucket_first(q) == to_insert) ? 0 : 1;
+  }
+
+  if (is_heap(q))
+  {
+    if (heap_reserve(q, q->size + 1) != 0)
+    {
+      return -1;
+    }
+    heap_append(q, to_insert);
+    heap_sift_up(q, q->heap, q->size);
+    q->size++;
+    //Finding the exact rank would cost a full scan, so only the head is reported precisely.
+    return (q->heap[0] == to_insert) ? 0 : 1;
+  }
+
+  int current_index = 0;
+  Node* previous_node = NULL;
+  Node* current_node = q->first;
+
+  //Walk past every node that should stay in front, equal ones offered earlier included (FIFO).
+  if (q->typed != NULL)
+  {
+    previous_node = q->typed->list_scan(q->first, to_insert, &current_index);
+    current_node = (previous_node == NULL) ? q->first : previous_node->next;
+  }
+  else
+  {
+    while (current_node != NULL && node_before(q, current_node, to_insert))
+    {
+      previous_node = current_node;
+      current_node = current_node->next;
+      current_index++;
+    }
+  }
+
+  //Place the new node between previous_node and current_node.
+  if (previous_node == NULL)
+  {
+    q->first = to_insert;
+  }
+  else
+  {
+    previous_node->next = to_insert;
+  }
+  to_insert->prev = previous_node;
+  to_insert->next = current_node;
+  if (current_node != NULL)
+  {
+    current_node->prev = to_insert;
+  }
+  q->size++;
+
+  return current_index;
 }
 
 
@@ -30,89 +836,174 @@ void priqueue_init(priqueue_t *q, int(*comparer)(const void *, const void *))
   @param q a pointer to an instance of the priqueue_t data structure
   @param ptr a pointer to the data to be inserted into the priority queue
   @return The zero-based index where ptr is stored in the priority queue, where 0 indicates that ptr was stored at the front of the priority queue.
+  With the heaps and PRIQUEUE_BUCKET only 0 is exact, every other position is reported as 1.
+  @return -1 if memory ran out, in which case ptr was not inserted
  */
 int priqueue_offer(priqueue_t *q, void *ptr)
 {
-  Node* to_insert = (Node*)malloc(sizeof(Node));
-  to_insert->next = NULL;
-  to_insert->ptr = ptr;
+  Node* to_insert = node_acquire(q, ptr);
+  if (to_insert == NULL)
+  {
+    return -1;
+  }
+  to_insert->order = q->next_order++;
+  int index = node_insert(q, to_insert);
+  if (index < 0)
+  {
+    node_release(q, to_insert);
+  }
+  return index;
+}
 
-	int current_index = 0;
-  Node* previous_node = NULL;
-  Node* current_node = q->first;
-  int comp_value = 0;
 
-  while (1)
+/**
+  Insert count elements at once. The queue ends up exactly as after count
+  calls to priqueue_offer() in the order given, equal elements included.
+  When the batch is at least as large as what is already queued, the heaps
+  append it whole and rebuild bottom-up in O(size) instead of sifting each
+  element up in O(log size).
+
+  @param q a pointer to an instance of the priqueue_t data structure
+  @param ptrs the elements to insert
+  @param count the number of elements in ptrs
+  @return 0 on success, -1 if memory ran out, in which case only the
+  elements before the one that could not be inserted are in the queue
+ */
+int priqueue_offer_batch(priqueue_t *q, void **ptrs, int count)
+{
+  int i, result = 0;
+  if (!is_heap(q) || count < q->size)
   {
-    if (current_node!=NULL)
+    for (i = 0; i < count; i++)
     {
-      comp_value = q->comp(ptr,current_node->ptr);
+      if (priqueue_offer(q, ptrs[i]) < 0)
+      {
+        return -1;
+      }
     }
+    return 0;
+  }
 
-    if (current_node == NULL || comp_value < 0)
+  if (heap_reserve(q, q->size + count) != 0)
+  {
+    return -1;
+  }
+  for (i = 0; i < count; i++)
+  {
+    Node* to_insert = node_acquire(q, ptrs[i]);
+    if (to_insert == NULL)
     {
-      Node* next_node; //The node that comes after to_insert
-      Node* connecting_node; //What node comes before the node we are inserting?
-      if (current_node != NULL && current_index != 0) //If it isn't at either end.
-      {
-        if (current_node->next != NULL)
-        {
-          connecting_node = current_node;
-          next_node = current_node->next;
-        }
-        else
-        {
-          connecting_node = previous_node;
-          next_node = current_node;
-        }
-      }
-      else if (current_index == 0) //If it is at the start.
-      {
-        connecting_node = NULL;
-        next_node = current_node;
-      }
-      else //If it is at the end.
-      {
-        connecting_node = previous_node;
-        next_node = NULL;
-      }
+      result = -1;
+      break;
+    }
+    to_insert->order = q->next_order++;
+    heap_append(q, to_insert);
+    q->size++;
+  }
+  for (i = q->size / 2 - 1; i >= 0; i--)
+  {
+    heap_sift_down(q, q->heap, q->size, i);
+  }
+  return result;
+}
 
-      //Place the new node.
-      if (connecting_node == NULL)
-      {
-        q->first = to_insert;
-      }
-      else
-      {
-        connecting_node->next = to_insert;
-      }
 
-      //Place the next node
-      to_insert->next = next_node;
-
-      // printf("PLACING A NODE: ");
-      // printf("[index = %d]", current_index);
-      // printf("[connecting = %p] ", connecting_node);
-      // printf("[insert = %p] ", to_insert);
-      // printf("[next = %p] ", next_node);
-      // if (current_node == NULL)
-      // {
-      //   printf("[END] ");
-      // }
-      // else
-      // {
-      //   printf("[comp = %d] ", comp_value);
-      // }
-      // printf("\n");
+/**
+  Insert the specified element and return a handle to it. The handle stays
+  valid until the element leaves the queue and can be given to
+  priqueue_update() and priqueue_remove_handle().
 
-      break;
+  @param q a pointer to an instance of the priqueue_t data structure
+  @param ptr a pointer to the data to be inserted into the priority queue
+  @return a handle on the queued element
+  @return NULL if memory ran out, in which case ptr was not inserted
+ */
+priqueue_handle_t priqueue_offer_handle(priqueue_t *q, void *ptr)
+{
+  Node* to_insert = node_acquire(q, ptr);
+  if (to_insert == NULL)
+  {
+    return NULL;
+  }
+  to_insert->order = q->next_order++;
+  if (node_insert(q, to_insert) < 0)
+  {
+    node_release(q, to_insert);
+    return NULL;
+  }
+  return to_insert;
+}
+
+
+/**
+  Returns the handle of an element already in an intrusive queue, i.e. its
+  embedded priqueue_link_t.
+
+  @param q a pointer to an instance of the priqueue_t data structure
+  @param ptr an element queued in q
+  @return the handle of ptr
+  @return NULL if q is not intrusive or ptr is not in q
+ */
+priqueue_handle_t priqueue_handle_of(priqueue_t *q, void *ptr)
+{
+  if (!q->intrusive)
+  {
+    return NULL;
+  }
+  Node* node = (Node*)((char*)ptr + q->link_offset);
+  return (node->owner == q) ? node : NULL;
+}
+
+
+/**
+  Moves an element to its new place after its key changed, e.g. after aging
+  its priority or adjusting its remaining time. Elements that compare equal
+  keep the order they were originally offered in.
+
+  O(log n) for the heaps, O(1) for PRIQUEUE_BUCKET, O(n) for PRIQUEUE_LIST.
+
+  @param q a pointer to an instance of the priqueue_t data structure
+  @param handle the handle of a queued element
+  @return 0 on success, -1 if a PRIQUEUE_BUCKET queue had to grow and memory
+  ran out; the element has then left the queue and its handle is spent
+ */
+int priqueue_update(priqueue_t *q, priqueue_handle_t handle)
+{
+  if (is_heap(q))
+  {
+    if (q->backend == PRIQUEUE_KEYED_HEAP)
+    {
+      q->heap_keys[handle->index] = q->key(handle->ptr);
     }
-    previous_node = current_node;
-    current_node = current_node->next;
-    current_index++;
+    heap_sift_up(q, q->heap, handle->index);
+    heap_sift_down(q, q->heap, q->size, handle->index);
+    return 0;
   }
-  
-  return current_index;
+  node_unlink(q, handle);
+  if (node_insert(q, handle) < 0)
+  {
+    node_release(q, handle);
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+  Removes a single element through its handle without searching for it.
+
+  O(log n) for the heaps, O(1) for PRIQUEUE_LIST and PRIQUEUE_BUCKET.
+
+  @param q a pointer to an instance of the priqueue_t data structure
+  @param handle the handle of a queued element
+  @return the element removed from the queue
+ */
+void *priqueue_remove_handle(priqueue_t *q, priqueue_handle_t handle)
+{
+  node_unlink(q, handle);
+  void* ptr = handle->ptr;
+  node_release(q, handle);
+  return ptr;
 }
 
 
@@ -126,7 +1017,16 @@ int priqueue_offer(priqueue_t *q, void *ptr)
  */
 void *priqueue_peek(priqueue_t *q)
 {
-	return q->first;
+  if (is_heap(q))
+  {
+    return (q->size == 0) ? NULL : q->heap[0]->ptr;
+  }
+  if (q->backend == PRIQUEUE_BUCKET)
+  {
+    Node* head = bucket_first(q);
+    return (head == NULL) ? NULL : head->ptr;
+  }
+  return (q->first == NULL) ? NULL : q->first->ptr;
 }
 
 
@@ -140,15 +1040,29 @@ void *priqueue_peek(priqueue_t *q)
  */
 void *priqueue_poll(priqueue_t *q)
 {
-	if (q->first == NULL)
+  if (is_heap(q))
+  {
+    if (q->size == 0)
+    {
+      return NULL;
+    }
+    Node* to_return = heap_take(q, 0);
+    void* ptr = to_return->ptr;
+    node_release(q, to_return);
+    return ptr;
+  }
+
+	if (chain_first(q) == NULL)
   {
     return NULL;
   }
   else
   {
-    Node* to_return = q->first;
-    q->first = q->first->next;
-    return to_return->ptr;
+    Node* to_return = chain_first(q);
+    node_unlink(q, to_return);
+    void* ptr = to_return->ptr;
+    node_release(q, to_return);
+    return ptr;
   }
 }
 
@@ -164,8 +1078,14 @@ void *priqueue_poll(priqueue_t *q)
  */
 void *priqueue_at(priqueue_t *q, int index)
 {
+  if (is_heap(q))
+  {
+    Node* selected = heap_select(q, index);
+    return (selected == NULL) ? NULL : selected->ptr;
+  }
+
   int current_index = 0;
-  Node* current_node = q->first;
+  Node* current_node = chain_first(q);
 
   while (1)
   {
@@ -178,7 +1098,7 @@ void *priqueue_at(priqueue_t *q, int index)
     {
       return current_node->ptr;
     }
-    current_node = current_node->next;
+    current_node = chain_after(q, current_node);
     current_index++;
   }
 }
@@ -195,10 +1115,47 @@ void *priqueue_at(priqueue_t *q, int index)
  */
 int priqueue_remove(priqueue_t *q, void *ptr)
 {
-  
+  if (q->intrusive)
+  {
+    //The element carries its own link, so there is nothing to search for.
+    priqueue_handle_t handle = priqueue_handle_of(q, ptr);
+    if (handle == NULL)
+    {
+      return 0;
+    }
+    priqueue_remove_handle(q, handle);
+    return 1;
+  }
+
+  if (is_heap(q))
+  {
+    //Compact out every match, then rebuild the heap bottom-up in O(n).
+    int kept = 0;
+    for (int i = 0; i < q->size; i++)
+    {
+      if (q->heap[i]->ptr == ptr)
+      {
+        node_release(q, q->heap[i]);
+      }
+      else
+      {
+        heap_move(q, kept++, i);
+      }
+    }
+    int removed = q->size - kept;
+    q->size = kept;
+    if (removed > 0)
+    {
+      for (int i = kept / 2 - 1; i >= 0; i--)
+      {
+        heap_sift_down(q, q->heap, kept, i);
+      }
+    }
+    return removed;
+  }
+
 	int removed_elements = 0;
-  Node* current_node = q->first;
-  Node* previous_node = NULL;
+  Node* current_node = chain_first(q);
 
   while (1)
   {
@@ -209,26 +1166,14 @@ int priqueue_remove(priqueue_t *q, void *ptr)
     if (current_node->ptr == ptr)
     {
       Node* old_current_node = current_node;
-      if (previous_node == NULL)
-      {
-        q->first = q->first->next;
-        current_node = q->first;
-        previous_node = NULL;
-      }
-      else
-      {
-        previous_node->next = current_node->next;
-        current_node = current_node->next;
-        previous_node = previous_node;
-        
-      }
+      current_node = chain_after(q, current_node);
+      node_unlink(q, old_current_node);
       removed_elements++;
-      free(old_current_node);
+      node_release(q, old_current_node);
     }
     else
     {
-      previous_node = current_node;
-      current_node = current_node->next;
+      current_node = chain_after(q, current_node);
     }
   }
 }
@@ -245,9 +1190,21 @@ int priqueue_remove(priqueue_t *q, void *ptr)
  */
 void *priqueue_remove_at(priqueue_t *q, int index)
 {
+  if (is_heap(q))
+  {
+    Node* selected = heap_select(q, index);
+    if (selected == NULL)
+    {
+      return NULL;
+    }
+    heap_take(q, selected->index);
+    void* ptr = selected->ptr;
+    node_release(q, selected);
+    return ptr;
+  }
+
 	int current_index = 0;
-  Node* current_node = q->first;
-  Node* previous_node = NULL;
+  Node* current_node = chain_first(q);
   while (1)
   {
     if (current_node == NULL)
@@ -256,22 +1213,14 @@ void *priqueue_remove_at(priqueue_t *q, int index)
     }
     if (index == current_index)
     {
-      Node* old_current_node = current_node;
-      if (previous_node == NULL)
-      {
-        q->first = q->first->next;
-      }
-      else
-      {
-        
-        previous_node->next = current_node->next;
-      }
-      return old_current_node->ptr;
-      free(old_current_node);
+      node_unlink(q, current_node);
+      void* ptr = current_node->ptr;
+      node_release(q, current_node);
+      return ptr;
     }
 
-    previous_node = current_node;
-    current_node = current_node->next;
+    current_node = chain_after(q, current_node);
+    current_index++;
   }
 }
 
@@ -284,18 +1233,83 @@ void *priqueue_remove_at(priqueue_t *q, int index)
  */
 int priqueue_size(priqueue_t *q)
 {
-  int number_of_elements = 0;
-	Node* current_node = q->first;
+  return q->size;
+}
 
-  while (1)
+
+/**
+  Starts a walk over the queue in the order elements would be polled. The
+  queue must not be modified until priqueue_iter_next() returns NULL or
+  priqueue_iter_end() is called.
+
+  @param q a pointer to an instance of the priqueue_t data structure
+  @param it the iterator to set up
+ */
+void priqueue_iter_begin(priqueue_t *q, priqueue_iter_t *it)
+{
+  it->q = q;
+  it->node = is_heap(q) ? NULL : chain_first(q);
+  it->scratch = NULL;
+  it->remaining = 0;
+
+  if (is_heap(q) && q->size > 0)
   {
-    if (current_node == NULL)
+    //Walking a heap in order means popping a private copy of it.
+    it->scratch = malloc(q->size * sizeof(Node*));
+    for (int i = 0; i < q->size; i++)
+    {
+      it->scratch[i] = q->heap[i];
+    }
+    it->remaining = q->size;
+  }
+}
+
+
+/**
+  Returns the next element of the walk started by priqueue_iter_begin().
+
+  @param it the iterator
+  @return the next element in poll order
+  @return NULL once every element has been returned
+ */
+void *priqueue_iter_next(priqueue_iter_t *it)
+{
+  if (is_heap(it->q))
+  {
+    if (it->remaining == 0)
     {
-      return number_of_elements;
+      priqueue_iter_end(it);
+      return NULL;
     }
-    number_of_elements++;
-    current_node = current_node->next;
+    Node* head = it->scratch[0];
+    it->remaining--;
+    it->scratch[0] = it->scratch[it->remaining];
+    heap_sift_down(it->q, it->scratch, it->remaining, 0);
+    return head->ptr;
+  }
+
+  if (it->node == NULL)
+  {
+    return NULL;
   }
+  void* ptr = it->node->ptr;
+  it->node = chain_after(it->q, it->node);
+  return ptr;
+}
+
+
+/**
+  Releases an iterator before it has run to the end. Calling it on a finished
+  iterator does nothing.
+
+  @param it the iterator
+ */
+void priqueue_iter_end(priqueue_iter_t *it)
+{
+  free(it->scratch);
+  it->scratch = NULL;
+  it->remaining = 0;
+  it->node = NULL;
 }
 
 
@@ -306,12 +1320,55 @@ int priqueue_size(priqueue_t *q)
  */
 void priqueue_destroy(priqueue_t *q)
 {
-  while (1)
+  //Embedded links belong to the elements; just mark them as out of the queue.
+  if (q->intrusive)
   {
-    void* result = priqueue_remove_at(q, 0);
-    if (result == NULL)
-    {
-      break;
-    }
+    while (priqueue_poll(q) != NULL);
+  }
+
+  //Every node lives in a slab, so releasing the slabs releases the nodes too.
+  while (q->slabs != NULL)
+  {
+    priqueue_slab_t* slab = q->slabs;
+    q->slabs = slab->next;
+    free(slab);
+  }
+  free(q->heap);
+  free(q->heap_keys);
+  free(q->heap_orders);
+  free(q->buckets);
+  free(q->bucket_bits);
+
+  q->first = NULL;
+  q->heap = NULL;
+  q->heap_keys = NULL;
+  q->heap_orders = NULL;
+  q->buckets = NULL;
+  q->bucket_bits = NULL;
+  q->bucket_count = 0;
+  q->size = 0;
+  q->heap_capacity = 0;
+  q->free_nodes = NULL;
+  q->slab_nodes = PRIQUEUE_SLAB_MIN_NODES;
+  q->nodes_in_use = 0;
+  q->nodes_capacity = 0;
+}
+
+
+/**
+  Reports how many nodes the queue's allocator is holding.
+
+  @param q a pointer to an instance of the priqueue_t data structure
+  @param stats filled in with the allocator counters
+ */
+void priqueue_stats(priqueue_t *q, priqueue_stats_t *stats)
+{
+  stats->nodes_in_use = q->nodes_in_use;
+  stats->nodes_high_water = q->nodes_high_water;
+  stats->nodes_capacity = q->nodes_capacity;
+  stats->slabs = 0;
+  for (priqueue_slab_t* slab = q->slabs; slab != NULL; slab = slab->next)
+  {
+    stats->slabs++;
   }
 }
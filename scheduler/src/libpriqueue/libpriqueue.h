@@ -4,25 +4,148 @@
 #ifndef LIBPRIQUEUE_H_
 #define LIBPRIQUEUE_H_
 
+#include <stddef.h>
+
 /**
   Priqueue Data Structure
 */
 typedef struct Node
 {
   struct Node* next; //This is the next node in the linked list.
+  struct Node* prev; //Previous node in the linked list, NULL for the head.
   void* ptr; //This is the job that the node is pointing at. See libscheduler.c for more...
+  unsigned long order; //Insertion number, used by the heap to keep equal elements in FIFO order.
+  int index; //Current slot in the heap array (heap backends) or key of the element (PRIQUEUE_BUCKET).
+  struct _priqueue_t* owner; //Queue the node is linked into, NULL while it is out of any queue.
 } Node;
 
+/**
+  A Node embedded directly in an element so an intrusive queue (see
+  priqueue_init_intrusive()) can link it without allocating.
+*/
+typedef Node priqueue_link_t;
+
+/**
+  Names one queued element for priqueue_update() and priqueue_remove_handle().
+*/
+typedef Node* priqueue_handle_t;
+
+/**
+  A block of nodes owned by one queue. Slabs are chained together and only
+  freed by priqueue_destroy().
+*/
+typedef struct _priqueue_slab_t
+{
+  struct _priqueue_slab_t* next;
+  Node nodes[];
+} priqueue_slab_t;
+
+#define PRIQUEUE_SLAB_MIN_NODES 32
+#define PRIQUEUE_SLAB_MAX_NODES 4096
+//Largest ring of a PRIQUEUE_BUCKET queue; wider key spans turn it into a PRIQUEUE_KEYED_HEAP.
+#define PRIQUEUE_BUCKET_MAX_COUNT (1 << 16)
+
+/**
+  Storage used behind the priqueue_* functions. Both keep equal elements in
+  the order they were offered.
+    - PRIQUEUE_LIST: sorted singly linked list, O(n) offer and O(1) poll.
+    - PRIQUEUE_HEAP: array backed binary heap, O(log n) offer and poll.
+    - PRIQUEUE_BUCKET: FIFO buckets indexed by an integer key (see
+      priqueue_set_key()) plus a bitmap of the non-empty ones, O(1) offer
+      and poll. Meant for keys that span a small range at any one time:
+      once the live keys span PRIQUEUE_BUCKET_MAX_COUNT or more, the queue
+      moves its elements to a PRIQUEUE_KEYED_HEAP and stays one.
+    - PRIQUEUE_KEYED_HEAP: binary heap whose integer keys (see
+      priqueue_set_key()) and tie-break orders are cached in arrays running
+      parallel to the node array, O(log n) offer and poll. Sifting reads only
+      those arrays instead of dereferencing every element it compares. A key
+      that changes while queued must be followed by priqueue_update().
+*/
+typedef enum {PRIQUEUE_LIST = 0, PRIQUEUE_HEAP, PRIQUEUE_BUCKET, PRIQUEUE_KEYED_HEAP} priqueue_backend_t;
+
+/**
+  One FIFO bucket of the PRIQUEUE_BUCKET backend.
+*/
+typedef struct _priqueue_bucket_t
+{
+  struct Node* head;
+  struct Node* tail;
+} priqueue_bucket_t;
+
+/**
+  Comparer, key and hot loops of one element type, generated with
+  PRIQUEUE_DEFINE_TYPED() and installed with priqueue_set_typed(). The heap
+  sifts and the list scan then run with the comparison inlined instead of one
+  call through comp per element visited.
+*/
+typedef struct _priqueue_typed_t
+{
+  int(*compare)(const void *, const void *);
+  int(*key)(const void *);
+  void(*sift_up)(struct Node **heap, int index);
+  void(*sift_down)(struct Node **heap, int size, int index);
+  struct Node*(*list_scan)(struct Node *first, const struct Node *node, int *index);
+} priqueue_typed_t;
+
 typedef struct _priqueue_t
 {
-  struct Node* first;
+  struct Node* first; //Head of the sorted list (PRIQUEUE_LIST only).
   int(*comp)(const void *, const void *);
+  priqueue_backend_t backend;
+  struct Node** heap; //heap[0] is the head of the queue (heap backends only).
+  int* heap_keys; //heap_keys[i] is the key of heap[i] (PRIQUEUE_KEYED_HEAP only).
+  unsigned long* heap_orders; //heap_orders[i] is heap[i]->order (PRIQUEUE_KEYED_HEAP only).
+  int size; //Number of elements currently queued, kept up to date by every call.
+  int heap_capacity;
+  unsigned long next_order; //Order handed to the next offered node.
+  struct Node* free_nodes; //Released nodes waiting to be reused, chained through next.
+  priqueue_slab_t* slabs;
+  int slab_nodes; //Size of the next slab, doubles up to PRIQUEUE_SLAB_MAX_NODES.
+  int nodes_in_use;
+  int nodes_high_water;
+  int nodes_capacity;
+  int intrusive; //Nonzero when elements carry their own priqueue_link_t.
+  size_t link_offset; //Where that link sits inside each element.
+  int(*key)(const void *); //Integer key of an element, see priqueue_set_key().
+  priqueue_bucket_t* buckets; //Ring of bucket_count buckets (PRIQUEUE_BUCKET only).
+  unsigned long long* bucket_bits; //One bit per bucket, set while it is non-empty.
+  int bucket_count;
+  int key_min; //Smallest key in the queue.
+  int key_max; //No key in the queue is larger than this.
+  const priqueue_typed_t* typed; //Specialized loops, NULL to go through comp.
 } priqueue_t;
 
+/**
+  Allocator counters reported by priqueue_stats().
+*/
+typedef struct _priqueue_stats_t
+{
+  int nodes_in_use; //Nodes currently holding an element.
+  int nodes_high_water; //Most nodes ever in use at once.
+  int nodes_capacity; //Nodes carved out of slabs so far.
+  int slabs;
+} priqueue_stats_t;
+
+/**
+  Walks a queue in poll order without removing anything, see priqueue_iter_begin().
+*/
+typedef struct _priqueue_iter_t
+{
+  priqueue_t* q;
+  struct Node* node; //Next node to hand out (PRIQUEUE_LIST and PRIQUEUE_BUCKET).
+  struct Node** scratch; //Private heap popped as the walk advances (heap backends only).
+  int remaining;
+} priqueue_iter_t;
+
 
-void   priqueue_init     (priqueue_t *q, int(*comparer)(const void *, const void *));
+void   priqueue_init        (priqueue_t *q, int(*comparer)(const void *, const void *));
+void   priqueue_init_backend(priqueue_t *q, int(*comparer)(const void *, const void *), priqueue_backend_t backend);
+void   priqueue_init_intrusive(priqueue_t *q, int(*comparer)(const void *, const void *), priqueue_backend_t backend, size_t link_offset);
+void   priqueue_set_key     (priqueue_t *q, int(*key)(const void *));
+void   priqueue_set_typed   (priqueue_t *q, const priqueue_typed_t *typed);
 
 int    priqueue_offer    (priqueue_t *q, void *ptr);
+int    priqueue_offer_batch(priqueue_t *q, void **ptrs, int count);
 void * priqueue_peek     (priqueue_t *q);
 void * priqueue_poll     (priqueue_t *q);
 void * priqueue_at       (priqueue_t *q, int index);
@@ -30,6 +153,95 @@ int    priqueue_remove   (priqueue_t *q, void *ptr);
 void * priqueue_remove_at(priqueue_t *q, int index);
 int    priqueue_size     (priqueue_t *q);
 
+priqueue_handle_t priqueue_offer_handle (priqueue_t *q, void *ptr);
+priqueue_handle_t priqueue_handle_of    (priqueue_t *q, void *ptr);
+int               priqueue_update       (priqueue_t *q, priqueue_handle_t handle);
+void *            priqueue_remove_handle(priqueue_t *q, priqueue_handle_t handle);
+
+void   priqueue_iter_begin(priqueue_t *q, priqueue_iter_t *it);
+void * priqueue_iter_next (priqueue_iter_t *it);
+void   priqueue_iter_end  (priqueue_iter_t *it);
+
 void   priqueue_destroy  (priqueue_t *q);
+void   priqueue_stats    (priqueue_t *q, priqueue_stats_t *stats);
+
+
+/**
+  Generates a queue specialization for elements of type `type` ordered by the
+  integer member `field`, where a comes out before b when
+  a->field op b->field (use < for smallest first, > for largest first).
+  Equal elements stay FIFO. It defines, all static:
+    - int name(const void *, const void *): the plain comparer, for code
+      that still goes through the void * API.
+    - name##_typed: a priqueue_typed_t to hand to priqueue_set_typed(),
+      whose key also makes the queue usable as a PRIQUEUE_BUCKET. For >
+      the key is ~field, which reverses the order of every int, INT_MIN
+      included, where -field would overflow.
+*/
+#define PRIQUEUE_DEFINE_TYPED(name, type, field, op)                                    \
+static int name(const void *a, const void *b)                                           \
+{                                                                                       \
+  if (((const type*)a)->field op ((const type*)b)->field) return -1;                    \
+  if (((const type*)b)->field op ((const type*)a)->field) return 1;                     \
+  return 0;                                                                             \
+}                                                                                       \
+static int name##_key(const void *a)                                                    \
+{                                                                                       \
+  return (0 op 1) ? ((const type*)a)->field : ~((const type*)a)->field;                 \
+}                                                                                       \
+static inline int name##_before(const Node *a, const Node *b)                           \
+{                                                                                       \
+  const type* x = a->ptr;                                                               \
+  const type* y = b->ptr;                                                               \
+  if (x->field op y->field) return 1;                                                   \
+  if (y->field op x->field) return 0;                                                   \
+  return a->order < b->order;                                                           \
+}                                                                                       \
+static void name##_sift_up(Node **heap, int index)                                      \
+{                                                                                       \
+  Node* moving = heap[index];                                                           \
+  while (index > 0)                                                                     \
+  {                                                                                     \
+    int parent = (index - 1) / 2;                                                       \
+    if (!name##_before(moving, heap[parent])) break;                                    \
+    heap[index] = heap[parent];                                                         \
+    heap[index]->index = index;                                                         \
+    index = parent;                                                                     \
+  }                                                                                     \
+  heap[index] = moving;                                                                 \
+  moving->index = index;                                                                \
+}                                                                                       \
+static void name##_sift_down(Node **heap, int size, int index)                          \
+{                                                                                       \
+  Node* moving = heap[index];                                                           \
+  while (1)                                                                             \
+  {                                                                                     \
+    int child = 2 * index + 1;                                                          \
+    if (child >= size) break;                                                           \
+    if (child + 1 < size && name##_before(heap[child + 1], heap[child])) child++;       \
+    if (!name##_before(heap[child], moving)) break;                                     \
+    heap[index] = heap[child];                                                          \
+    heap[index]->index = index;                                                         \
+    index = child;                                                                      \
+  }                                                                                     \
+  heap[index] = moving;                                                                 \
+  moving->index = index;                                                                \
+}                                                                                       \
+static Node* name##_list_scan(Node *first, const Node *node, int *index)                \
+{                                                                                       \
+  Node* previous_node = NULL;                                                           \
+  *index = 0;                                                                           \
+  for (Node* current_node = first; current_node != NULL; current_node = current_node->next) \
+  {                                                                                     \
+    if (!name##_before(current_node, node)) break;                                      \
+    previous_node = current_node;                                                       \
+    (*index)++;                                                                         \
+  }                                                                                     \
+  return previous_node;                                                                 \
+}                                                                                       \
+static const priqueue_typed_t name##_typed =                                            \
+{                                                                                       \
+  name, name##_key, name##_sift_up, name##_sift_down, name##_list_scan                  \
+};
 
 #endif /* LIBPQUEUE_H_ */
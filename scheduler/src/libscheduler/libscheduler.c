@@ -4,29 +4,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 
 #include "libscheduler.h"
 #include "../libpriqueue/libpriqueue.h"
 #include <stdbool.h>
 
 /** @GLOBALS: 
-  int currTime = 0;
-  int totalTurnaround = 0;
-  int totalWait = 0;
-  int totalResponse = 0;
-  int totalJobs = 0;
-  //GLOBAL QUEUE FOR USE IN SCHEDULING
-  priqueue_t* readyQueue;
-  //Array of CPU cores to run current job;
-  job_t** arr_Cores;
-  int num_Cores;
-  scheme_t schem_Curr;
+  All scheduler state lives in scheduler_t (see libscheduler.h). The
+  scheduler_*() functions without the _ctx suffix work on defaultScheduler.
 */
-int currTime = 0;
-int totalTurnaround = 0;
-int totalWait = 0;
-int totalResponse = 0;
-int totalJobs = 0;
+static scheduler_t defaultScheduler;
+#define CORE_WORD_BITS 64
 /**
   Stores information making up a job to be scheduled including any statistics.
   You may need to define some global variables or a struct to store your job queue elements. 
@@ -42,124 +31,134 @@ int totalJobs = 0;
 //   int virgin;
 // } job_t;
 
-/**
-  @return: return 1 if newJob is higher priority based on earlier arrivalTime
-  -1 if newJob->arrivalTime < jobInQ->arrivalTime
-   0 if newJob->arrivalTime == jobInQ->arrivalTime
-   1 if newJob->arrivalTime > jobInQ->arrivalTime
-  this will allow for comparison in while loop based on return from this function 
-  while its necessary to continue traversing further into the PQ past the higher priority
-  jobs. For this specific scheme this could be done by just putting the new job at the end.
+/*
+  Comparators for each scheme. Each one orders jobs on a single job_t field and
+  is generated by PRIQUEUE_DEFINE_TYPED(), which also emits <name>_typed: the
+  same ordering with the comparison inlined into the queue's heap sifts and
+  list scan, and a bucket key for PRIQUEUE_BUCKET.
+
+  Ties keep the order the jobs were offered in.
 */
-int fcfs(const void* newJob, const void* jobInQ){
-  if(((job_t*)newJob)->arrivalTime < ((job_t*)jobInQ)->arrivalTime){
-    return -1;
-  }
-  else if(((job_t*)newJob)->arrivalTime > ((job_t*)jobInQ)->arrivalTime){
-    return 1;
-  }
-  else{
-    return 0;
-  }
-}
-/**
-  @return: return 1 if newJob is higher priority based on shorter burstTime
-  -1 newJob->burstTime < jobInQ->burstTime
-   0 if newJob->burstTime == jobInQ->burstTime 
-   1 if newJob->burstTime > jobInQ->burstTime 
-  this will allow for comparison in while loop based on return from this function 
-  while its necessary to continue traversing further into the PQ past the higher priority
-  jobs. 
+//earlier arrivalTime first. For this specific scheme this could be done by just putting the new job at the end.
+PRIQUEUE_DEFINE_TYPED(fcfs, job_t, arrivalTime, <)
+//shorter burstTime first
+PRIQUEUE_DEFINE_TYPED(sjf, job_t, burstTime, <)
+//shorter remainBurstTime first. newJob->burstTime === newJob->remainBurstTime for a new job
+PRIQUEUE_DEFINE_TYPED(psjf, job_t, remainBurstTime, <)
+//LARGER priority value first
+PRIQUEUE_DEFINE_TYPED(pri, job_t, priority, >)
+//LARGER priority value first
+PRIQUEUE_DEFINE_TYPED(ppri, job_t, priority, >)
+//earlier reenterTime first, which imposes fcfs among jobs re-entering the queue
+PRIQUEUE_DEFINE_TYPED(rr, job_t, reenterTime, <)
+
+/*
+  Orders running jobs for preemption: the head is the job with the most
+  remaining burst time (PSJF) or the largest priority value (PPRI), the lowest
+  core id winning ties, which is what the old scan over arr_Cores picked.
+  PSJF orders on the time each job would finish if left running, which ranks
+  them as their remaining burst times would at any moment without ever going
+  stale as they run.
 */
-int sjf(const void* newJob, const void* jobInQ){
-  if(((job_t*)newJob)->burstTime < ((job_t*)jobInQ)->burstTime){
-    return -1;
-  }
-  else if(((job_t*)newJob)->burstTime > ((job_t*)jobInQ)->burstTime){
-    return 1;
-  }
-  else{
-    return 0;
-  }
+int runningPSJF(const void* a, const void* b){
+  const job_t* x = a;
+  const job_t* y = b;
+  int xFinish = x->dispatchTime + x->remainBurstTime;
+  int yFinish = y->dispatchTime + y->remainBurstTime;
+  if(xFinish != yFinish){
+    return (xFinish > yFinish) ? -1 : 1;
+  }
+  return x->coreId - y->coreId;
 }
-/**
-  @return: return 1 if newJob is higher priority based on shorter remainBurstTime
-  -1 newJob->remainBurstTime < jobInQ->remainBurstTime
-   0 if newJob->remainBurstTime == jobInQ->remainBurstTime 
-   1 if newJob->remainBurstTime > jobInQ->remainBurstTime 
-  this will allow for comparison in while loop based on return from this function 
-  while its necessary to continue traversing further into the PQ past the higher priority
-  jobs. This can use remainBurstTime for both the job that is already in the Queue and 
-  the newJob because newJob->burstTime === newJob->remainBurstTime
-*/
-int psjf(const void* newJob, const void* jobInQ){
-  if(((job_t*)newJob)->remainBurstTime < ((job_t*)jobInQ)->remainBurstTime){
-    return -1;
-  }
-  else if(((job_t*)newJob)->remainBurstTime > ((job_t*)jobInQ)->remainBurstTime){
-    return 1;
-  }
-  else{
-    return 0;
+int runningPPRI(const void* a, const void* b){
+  const job_t* x = a;
+  const job_t* y = b;
+  if(x->priority != y->priority){
+    return (x->priority > y->priority) ? -1 : 1;
   }
+  return x->coreId - y->coreId;
 }
-/**
-  @return: return 1 if newJob is higher priority based on SMALLEST priority
-  -1 newJob->priority > jobInQ->priority
-   0 if newJob->priority == jobInQ->priority 
-   1 if newJob->priority < jobInQ->priority 
+/*
+Remaining burst time of a running job at time. remainBurstTime is only brought
+up to date when the job leaves its core, so nothing has to touch the running
+jobs as time passes.
 */
-int pri(const void* newJob, const void* jobInQ){
-  if(((job_t*)newJob)->priority > ((job_t*)jobInQ)->priority){
-    return -1;
-  }
-  else if(((job_t*)newJob)->priority < ((job_t*)jobInQ)->priority){
-    return 1;
-  }
-  else{
-    return 0;
-  }
+static int remainingTime(job_t* job, int time){
+  return job->remainBurstTime - (time - job->dispatchTime);
 }
-/**
-  @return: return 1 if newJob is higher priority based on SMALLEST priority value
-   0 if newJob->priority >= jobInQ->priority //imposes fcfs
-   1 if newJob->priority < jobInQ->priority 
+
+/*
+Job record pool. A record is found from its handle in O(1): the chunk is the
+high bits of the handle and the slot the low JOB_ARENA_CHUNK_BITS.
 */
-int ppri(const void* newJob, const void* jobInQ){
-  if(((job_t*)newJob)->priority > ((job_t*)jobInQ)->priority){
-    return -1;
-  }
-  else if(((job_t*)newJob)->priority < ((job_t*)jobInQ)->priority){
-    return 1;
-  }
-  else{
-    return 0;
-  }
+static job_t* jobArenaGet(job_arena_t* a, job_handle_t handle){
+  return &a->chunks[handle >> JOB_ARENA_CHUNK_BITS][handle & (JOB_ARENA_CHUNK_JOBS - 1)];
 }
-/**
-  @return: return 1 if newJob is higher priority based on reenterTime value
-   0 if newJob->reenterTime >= jobInQ->reenterTime //imposes fcfs
-   1 if newJob->reenterTime < jobInQ->reenterTime 
-*/
-int rr(const void* newJob, const void* jobInQ){
-  if(((job_t*)newJob)->reenterTime < ((job_t*)jobInQ)->reenterTime){
-    return -1;
-  }
-  else if(((job_t*)newJob)->reenterTime > ((job_t*)jobInQ)->reenterTime){
-    return 1;
+
+//takes a record off the freelist, or carves a fresh one, adding a chunk when the last one is full
+static job_t* jobArenaAlloc(job_arena_t* a){
+  job_t* job;
+  if(a->freeHead != JOB_HANDLE_NONE){
+    job = jobArenaGet(a, a->freeHead);
+    a->freeHead = job->nextFree;
   }
   else{
-    return 0;
+    if(a->carved == a->chunkCount * JOB_ARENA_CHUNK_JOBS){
+      if(a->chunkCount == a->chunkCapacity){
+        a->chunkCapacity = (a->chunkCapacity > 0) ? a->chunkCapacity * 2 : 8;
+        a->chunks = realloc(a->chunks, a->chunkCapacity * sizeof(job_t*));
+      }
+      a->chunks[a->chunkCount++] = malloc(JOB_ARENA_CHUNK_JOBS * sizeof(job_t));
+    }
+    job = jobArenaGet(a, a->carved);
+    job->handle = a->carved++;
+  }
+  a->inUse++;
+  if(a->inUse > a->highWater){
+    a->highWater = a->inUse;
   }
+  return job;
 }
-//update remaining time of each active job within all cores
-void timeSync(int newTime){
-  for(int i = 0; i < num_Cores; i++){
-    if(arr_Cores[i] != NULL){
-      arr_Cores[i]->remainBurstTime -= (newTime - currTime);
-    }
+
+//puts a record back on the freelist for the next job
+static void jobArenaFree(job_arena_t* a, job_t* job){
+  job->nextFree = a->freeHead;
+  a->freeHead = job->handle;
+  a->inUse--;
+}
+
+//set up an empty queue of waiting jobs ordered the way the scheme wants
+static void initReadyQueue(scheduler_t* s, priqueue_t* q){
+  const priqueue_typed_t* typed = NULL;
+  priqueue_backend_t backend = PRIQUEUE_KEYED_HEAP;
+  switch(s->schem_Curr){
+    case FCFS:
+          typed = &fcfs_typed;
+          break;
+    case SJF:
+          typed = &sjf_typed;
+          break;
+    case PSJF:
+          typed = &psjf_typed;
+          break;
+    //priorities and reenter times are usually small integer keys, so these get O(1) buckets
+    //(the queue turns itself into a keyed heap if they spread too far apart)
+    case PRI:
+          typed = &pri_typed;
+          backend = PRIQUEUE_BUCKET;
+          break;
+    case PPRI:
+          typed = &ppri_typed;
+          backend = PRIQUEUE_BUCKET;
+          break;
+    case RR:
+          //purposely used fcfs
+          typed = &rr_typed;
+          backend = PRIQUEUE_BUCKET;
+          break;
   }
-  currTime = newTime;
+  priqueue_init_intrusive(q, typed->compare, backend, offsetof(job_t, link));
+  priqueue_set_typed(q, typed);
 }
 
 /**
@@ -171,40 +170,75 @@ void timeSync(int newTime){
     - You may assume that cores is a positive, non-zero number.
     - You may assume that scheme is a valid scheduling scheme.
 
+  @param s the scheduler instance to initialize
   @param cores the number of cores that is available by the scheduler. These cores will be known as core(id=0), core(id=1), ..., core(id=cores-1).
   @param scheme  the scheduling scheme that should be used. This value will be one of the six enum values of scheme_t
 */
+void scheduler_start_up_ctx(scheduler_t* s, int cores, scheme_t scheme)
+{
+  s->num_Cores = cores;
+  s->schem_Curr = scheme;
+  histogram_init(&s->waitTimes);
+  histogram_init(&s->turnaroundTimes);
+  histogram_init(&s->responseTimes);
+  s->totalJobs = 0;
+  s->traceDecisions = 1;
+  s->coreQueues = NULL;
+  s->stealThreshold = 0;
+  s->steals = 0;
+  s->maxImbalance = 0;
+  s->imbalanceTotal = 0;
+  s->imbalanceSamples = 0;
+  s->jobs.chunks = NULL;
+  s->jobs.chunkCount = 0;
+  s->jobs.chunkCapacity = 0;
+  s->jobs.freeHead = JOB_HANDLE_NONE;
+  s->jobs.carved = 0;
+  s->jobs.inUse = 0;
+  s->jobs.highWater = 0;
+  s->batch = NULL;
+  s->batchCapacity = 0;
+  s->arr_Cores = malloc(s->num_Cores * sizeof(job_t*));
+  s->idleCores = calloc((s->num_Cores + CORE_WORD_BITS - 1) / CORE_WORD_BITS, sizeof(unsigned long long));
+  for(int i = 0; i < s->num_Cores; i++){
+    s->arr_Cores[i] = NULL;
+    s->idleCores[i / CORE_WORD_BITS] |= 1ULL << (i % CORE_WORD_BITS);
+  }
+  priqueue_init_intrusive(&s->runningQueue, (s->schem_Curr == PPRI) ? &runningPPRI : &runningPSJF, PRIQUEUE_HEAP, offsetof(job_t, coreLink));
+  initReadyQueue(s, &s->readyQueue);
+}
+
 void scheduler_start_up(int cores, scheme_t scheme)
 {
-  num_Cores = cores;
-  schem_Curr = scheme;
-  arr_Cores = malloc(num_Cores * sizeof(job_t*));
-  for(int i = 0; i < num_Cores; i++){
-    arr_Cores[i] = NULL;
-  }
-  readyQueue = malloc(sizeof(priqueue_t));
+  scheduler_start_up_ctx(&defaultScheduler, cores, scheme);
+}
 
-  switch(schem_Curr){
-    case FCFS:
-          priqueue_init(readyQueue, &fcfs);
-          break;
-    case SJF:
-          priqueue_init(readyQueue, &sjf);
-          break;
-    case PSJF:
-          priqueue_init(readyQueue, &psjf);
-          break;
-    case PRI:
-          priqueue_init(readyQueue, &pri);
-          break;
-    case PPRI:
-          priqueue_init(readyQueue, &ppri);
-          break;
-    case RR:
-          //purposely used fcfs
-          priqueue_init(readyQueue, &rr);
-          break;
+
+/**
+  Gives every core a run queue of its own instead of the shared readyQueue.
+  A job that has to wait joins the shortest run queue, a preempted or
+  expired job the queue of the core it left, and a core with nothing left in
+  its own queue steals the head of the longest peer queue, provided that one
+  holds at least steal_threshold jobs.
+
+  Assumption:
+    - This function is called right after scheduler_start_up_ctx().
+
+  @param s the scheduler instance
+  @param steal_threshold fewest waiting jobs a peer must have to be stolen from (at least 1)
+*/
+void scheduler_use_core_queues_ctx(scheduler_t* s, int steal_threshold)
+{
+  s->coreQueues = malloc(s->num_Cores * sizeof(priqueue_t));
+  for(int i = 0; i < s->num_Cores; i++){
+    initReadyQueue(s, &s->coreQueues[i]);
   }
+  s->stealThreshold = (steal_threshold > 1) ? steal_threshold : 1;
+}
+
+void scheduler_use_core_queues(int steal_threshold)
+{
+  scheduler_use_core_queues_ctx(&defaultScheduler, steal_threshold);
 }
 
 
@@ -220,6 +254,7 @@ void scheduler_start_up(int cores, scheme_t scheme)
   Assumption:
     - You may assume that every job wil have a unique arrival time.
 
+  @param s the scheduler instance
   @param job_number a globally unique identification number of the job arriving.
   @param time the current time of the simulator.
   @param running_time the total number of time units this job will run before it will be finished.
@@ -228,16 +263,82 @@ void scheduler_start_up(int cores, scheme_t scheme)
   @return -1 if no scheduling changes should be made. 
  
  */
-bool isPreemptive();
-int getCoreToPreemptPSJF();
-int getCoreToPreemptPPRI();
-int findEmptyCore();
-int putJobInCore(int core_id, job_t* new_job);
+static bool isPreemptive(scheduler_t* s);
+static int getCoreToPreemptPSJF(scheduler_t* s, job_t* new_job, int time);
+static int getCoreToPreemptPPRI(scheduler_t* s, job_t* new_job);
+static int findEmptyCore(scheduler_t* s);
+static int putJobInCore(scheduler_t* s, int core_id, job_t* new_job, int time);
+static void setCore(scheduler_t* s, int core_id, job_t* job, int time);
 
-int scheduler_new_job(int job_number, int time, int running_time, int priority)
+/*
+Queue a job has to wait in: the shared readyQueue, or with per-core run queues
+the one of core core_id, the shortest one (lowest core id on ties) for -1.
+*/
+static priqueue_t* waitQueue(scheduler_t* s, int core_id){
+  if(s->coreQueues == NULL){
+    return &s->readyQueue;
+  }
+  if(core_id == -1){
+    core_id = 0;
+    for(int i = 1; i < s->num_Cores; i++){
+      if(priqueue_size(&s->coreQueues[i]) < priqueue_size(&s->coreQueues[core_id])){
+        core_id = i;
+      }
+    }
+  }
+  return &s->coreQueues[core_id];
+}
+
+/*
+Takes the next job to run on core core_id off its queue. With per-core run
+queues an empty queue makes the core steal from the longest peer queue
+(lowest core id on ties), if that one holds at least stealThreshold jobs.
+*/
+static job_t* nextJob(scheduler_t* s, int core_id){
+  if(s->coreQueues == NULL){
+    return priqueue_poll(&s->readyQueue);
+  }
+  job_t* job = priqueue_poll(&s->coreQueues[core_id]);
+  if(job != NULL){
+    return job;
+  }
+  int victim = -1;
+  for(int i = 0; i < s->num_Cores; i++){
+    int waiting = priqueue_size(&s->coreQueues[i]);
+    if(i != core_id && waiting >= s->stealThreshold && (victim == -1 || waiting > priqueue_size(&s->coreQueues[victim]))){
+      victim = i;
+    }
+  }
+  if(victim == -1){
+    return NULL;
+  }
+  s->steals++;
+  return priqueue_poll(&s->coreQueues[victim]);
+}
+
+//with per-core run queues, record the gap between the longest and shortest one
+static void sampleImbalance(scheduler_t* s){
+  if(s->coreQueues == NULL){
+    return;
+  }
+  int longest = priqueue_size(&s->coreQueues[0]);
+  int shortest = longest;
+  for(int i = 1; i < s->num_Cores; i++){
+    int waiting = priqueue_size(&s->coreQueues[i]);
+    if(waiting > longest) longest = waiting;
+    if(waiting < shortest) shortest = waiting;
+  }
+  if(longest - shortest > s->maxImbalance){
+    s->maxImbalance = longest - shortest;
+  }
+  s->imbalanceTotal += longest - shortest;
+  s->imbalanceSamples++;
+}
+
+//takes a record for a job arriving now and counts it
+static job_t* makeJob(scheduler_t* s, int job_number, int time, int running_time, int priority)
 {
-  timeSync(time);
-  job_t* new_job = malloc(sizeof(job_t));
+  job_t* new_job = jobArenaAlloc(&s->jobs);
   new_job -> jobNumber = job_number;
   new_job -> arrivalTime = time;
   //must set this if the new job is going straight to a core to run 
@@ -249,69 +350,117 @@ int scheduler_new_job(int job_number, int time, int running_time, int priority)
   new_job -> virgin = 1;
   new_job -> reenterTime = time;
 
-  totalJobs++;
-  if (isPreemptive())
+  s->totalJobs++;
+  return new_job;
+}
+
+int scheduler_new_job_ctx(scheduler_t* s, int job_number, int time, int running_time, int priority)
+{
+  job_t* new_job = makeJob(s, job_number, time, running_time, priority);
+  if (isPreemptive(s))
   {
     int v;
     int x;
     new_job->startTime = time;
-    if(schem_Curr == PSJF){
-      v = getCoreToPreemptPSJF(new_job);
-      x = putJobInCore(getCoreToPreemptPSJF(new_job), new_job);
+    if(s->schem_Curr == PSJF){
+      v = getCoreToPreemptPSJF(s, new_job, time);
+      x = putJobInCore(s, v, new_job, time);
     }
-    else if(schem_Curr == PPRI){
-      v = getCoreToPreemptPPRI(new_job);
-      x = putJobInCore(getCoreToPreemptPPRI(new_job), new_job);
+    else if(s->schem_Curr == PPRI){
+      v = getCoreToPreemptPPRI(s, new_job);
+      x = putJobInCore(s, v, new_job, time);
     }
-    else if(schem_Curr == RR){
-      int core = findEmptyCore();
+    else if(s->schem_Curr == RR){
+      int core = findEmptyCore(s);
       if(core != -1){
         new_job->startTime = time;
         new_job->virgin = 0;
-        arr_Cores[core] = new_job;
+        setCore(s, core, new_job, time);
+        sampleImbalance(s);
         return core;
       }
-      priqueue_offer(readyQueue, new_job);
+      priqueue_offer(waitQueue(s, -1), new_job);
+      sampleImbalance(s);
       return -1;
     }
-    printf("Inside sched_new_job: return of getCoreToPreempt = %d\n", v);
-    printf("Inside sched_new_job: return of putJobInCore = %d\n", x);
+    if(s->traceDecisions){
+      printf("Inside sched_new_job: return of getCoreToPreempt = %d\n", v);
+      printf("Inside sched_new_job: return of putJobInCore = %d\n", x);
+    }
+    sampleImbalance(s);
     return x;
   }
   else
   { 
-    int core = findEmptyCore();
+    int core = findEmptyCore(s);
     if(core != -1)
     {
       new_job->startTime = time;
       new_job->virgin = 0;
-      arr_Cores[core] = new_job;
-      // putJobInCore(core, new_job);
+      setCore(s, core, new_job, time);
+      sampleImbalance(s);
       return core;
     }
-    priqueue_offer(readyQueue, new_job);
+    priqueue_offer(waitQueue(s, -1), new_job);
+    sampleImbalance(s);
     return -1;
   }
 }
 
+int scheduler_new_job(int job_number, int time, int running_time, int priority)
+{
+  return scheduler_new_job_ctx(&defaultScheduler, job_number, time, running_time, priority);
+}
+
 /*
 Get the empty core with the lowest id. If no cores are empty, return -1.
+Finds the first set bit of idleCores, a word of 64 cores at a time.
 */
-int findEmptyCore(){
-  for(int i = 0; i < num_Cores; i++){
-    if(arr_Cores[i]==NULL){
-      return i;
+static int findEmptyCore(scheduler_t* s){
+  int words = (s->num_Cores + CORE_WORD_BITS - 1) / CORE_WORD_BITS;
+  for(int i = 0; i < words; i++){
+    if(s->idleCores[i] != 0){
+      return i * CORE_WORD_BITS + __builtin_ctzll(s->idleCores[i]);
     }
   }
   return -1;
 }
 
+/*
+Every change of the job running on a core goes through here so idleCores and
+runningQueue stay in step with arr_Cores. job may be NULL to idle the core.
+The job leaving the core is charged for the time it ran, so its
+remainBurstTime is exact again by the time it is queued.
+*/
+static void setCore(scheduler_t* s, int core_id, job_t* job, int time)
+{
+  job_t* old = s->arr_Cores[core_id];
+  if (old != NULL)
+  {
+    priqueue_remove(&s->runningQueue, old);
+    old->remainBurstTime = remainingTime(old, time);
+  }
+  s->arr_Cores[core_id] = job;
+  if (job == NULL)
+  {
+    s->idleCores[core_id / CORE_WORD_BITS] |= 1ULL << (core_id % CORE_WORD_BITS);
+    return;
+  }
+  s->idleCores[core_id / CORE_WORD_BITS] &= ~(1ULL << (core_id % CORE_WORD_BITS));
+  job->coreId = core_id;
+  job->dispatchTime = time;
+  if (s->schem_Curr == PSJF || s->schem_Curr == PPRI)
+  {
+    priqueue_offer(&s->runningQueue, job);
+  }
+}
+
 /*
   Simple utility function to get whether or not a certain algorithim may be preemptive.
 */
-bool isPreemptive()
+static bool isPreemptive(scheduler_t* s)
 {
-  if (schem_Curr == PSJF || schem_Curr == PPRI || schem_Curr == RR)
+  if (s->schem_Curr == PSJF || s->schem_Curr == PPRI || s->schem_Curr == RR)
   {
     return true;
   }
@@ -320,62 +469,40 @@ bool isPreemptive()
 
 /*
   Return the core id of the core with the highest remaining burst time.
+  An idle core, if any, is used first.
 */
-int getCoreToPreemptPSJF(job_t* new_job)
+static int getCoreToPreemptPSJF(scheduler_t* s, job_t* new_job, int time)
 {
-  int greatest_burst = 0;
-  int greatest_id = -1;
-  for (int i = 0; i < num_Cores; i++)
+  int core = findEmptyCore(s);
+  if (core != -1)
   {
-    if (arr_Cores[i] != NULL && (greatest_burst < arr_Cores[i]->remainBurstTime))
-    {
-      greatest_id = i;
-      greatest_burst = arr_Cores[i]->remainBurstTime;
-    }
-    else if(arr_Cores[i] == NULL){
-      return i;
-    }
+    return core;
   }
-  if (new_job->remainBurstTime < greatest_burst)
+  job_t* victim = priqueue_peek(&s->runningQueue);
+  if (victim != NULL && new_job->remainBurstTime < remainingTime(victim, time))
   {
-    return greatest_id;
-  }
-  else
-  {
-    return findEmptyCore();
+    return victim->coreId;
   }
+  return -1;
 }
 
 /*
-  Return the core id of the core with the highest remaining burst time.
+  Return the core id of the core with the largest priority value.
+  An idle core, if any, is used first.
 */
-int getCoreToPreemptPPRI(job_t* new_job)
+static int getCoreToPreemptPPRI(scheduler_t* s, job_t* new_job)
 {
-  int lowest_pri = -1;
-  int lowest_id = -1;
-  for (int i = 0; i < num_Cores; i++)
+  int core = findEmptyCore(s);
+  if (core != -1)
   {
-    if(arr_Cores[i] != NULL && lowest_pri == -1){//init highest_pri with first non-null arr entry
-      lowest_id = i;
-      lowest_pri = arr_Cores[i]->priority;
-    }
-    if (arr_Cores[i] != NULL && (lowest_pri < arr_Cores[i]->priority))
-    {
-      lowest_id = i;
-      lowest_pri = arr_Cores[i]->priority;
-    }
-    else if(arr_Cores[i] == NULL){
-      return i;
-    }
+    return core;
   }
-  if (new_job->priority < lowest_pri)
+  job_t* victim = priqueue_peek(&s->runningQueue);
+  if (victim != NULL && new_job->priority < victim->priority)
   {
-    return lowest_id;
-  }
-  else
-  {
-    return findEmptyCore();
+    return victim->coreId;
   }
+  return -1;
 }
 
 /*
@@ -383,21 +510,22 @@ Puts a job in a core.
 If the core is not empty, the job on the core will be offered to the ready queue.
 If the core number is -1, the job will be offered to the ready queue.
 */
-int putJobInCore(int core_id, job_t* new_job)
+static int putJobInCore(scheduler_t* s, int core_id, job_t* new_job, int time)
 {
   //no empty cores case
   if (core_id == -1)
   {
-    priqueue_offer(readyQueue, new_job);
+    priqueue_offer(waitQueue(s, -1), new_job);
     return -1;
   }
-  //preempt core 
-  if (arr_Cores[core_id] != NULL)
+  //preempt core, queueing the old job once setCore has charged it for its run
+  job_t* preempted = s->arr_Cores[core_id];
+  new_job->virgin = 0;
+  setCore(s, core_id, new_job, time);
+  if (preempted != NULL)
   {
-    priqueue_offer(readyQueue, arr_Cores[core_id]);
+    priqueue_offer(waitQueue(s, core_id), preempted);
   }
-  new_job->virgin = 0;
-  arr_Cores[core_id] = new_job;
   return core_id;
 }
 /**
@@ -408,35 +536,43 @@ int putJobInCore(int core_id, job_t* new_job)
   finished job, return the job_number of the job that should be scheduled to
   run on core core_id.
  
+  @param s the scheduler instance
   @param core_id the zero-based index of the core where the job was located.
   @param job_number a globally unique identification number of the job.
   @param time the current time of the simulator.
   @return job_number of the job that should be scheduled to run on core core_id
   @return -1 if core should remain idle.
  */
-int scheduler_job_finished(int core_id, int job_number, int time)
+int scheduler_job_finished_ctx(scheduler_t* s, int core_id, int job_number, int time)
 {
-  totalWait += (time - arr_Cores[core_id]->burstTime - arr_Cores[core_id]->arrivalTime);
-  totalTurnaround += (time - arr_Cores[core_id]->arrivalTime);
-  totalResponse += (arr_Cores[core_id]->startTime - arr_Cores[core_id]->arrivalTime);
-  job_t* frontJob = (job_t*)priqueue_poll(readyQueue);
-  job_t* terminatedJob = arr_Cores[core_id];
-  free(terminatedJob); 
+  histogram_record(&s->waitTimes, time - s->arr_Cores[core_id]->burstTime - s->arr_Cores[core_id]->arrivalTime);
+  histogram_record(&s->turnaroundTimes, time - s->arr_Cores[core_id]->arrivalTime);
+  histogram_record(&s->responseTimes, s->arr_Cores[core_id]->startTime - s->arr_Cores[core_id]->arrivalTime);
+  job_t* frontJob = nextJob(s, core_id);
+  job_t* terminatedJob = s->arr_Cores[core_id];
+  setCore(s, core_id, NULL, time);
+  jobArenaFree(&s->jobs, terminatedJob);
   if(frontJob != NULL){
     //check if process that is going into core is virgin
     if(frontJob->virgin){
       frontJob->virgin = 0;//no longer virgin because it going to run now
       frontJob->startTime = time;//set start time of job entering core to run
     }
-    arr_Cores[core_id] = frontJob;
+    setCore(s, core_id, frontJob, time);
+    sampleImbalance(s);
     return frontJob->jobNumber;
   }
   else{
-    arr_Cores[core_id] = NULL;
+    sampleImbalance(s);
     return -1;
   }
 }
 
+int scheduler_job_finished(int core_id, int job_number, int time)
+{
+  return scheduler_job_finished_ctx(&defaultScheduler, core_id, job_number, time);
+}
+
 
 /**
   When the scheme is set to RR, called when the quantum timer has expired
@@ -446,24 +582,109 @@ int scheduler_job_finished(int core_id, int job_number, int time)
   the quantum expiration, return the job_number of the job that should be
   scheduled to run on core core_id.
 
+  @param s the scheduler instance
   @param core_id the zero-based index of the core where the quantum has expired.
   @param time the current time of the simulator. 
   @return job_number of the job that should be scheduled on core cord_id
   @return -1 if core should remain idle
  */
-int scheduler_quantum_expired(int core_id, int time)
+int scheduler_quantum_expired_ctx(scheduler_t* s, int core_id, int time)
 {
-  //timeSync(time);
-  job_t* expiredJob = arr_Cores[core_id];
+  job_t* expiredJob = s->arr_Cores[core_id];
   expiredJob->reenterTime = time;
-  priqueue_offer(readyQueue, expiredJob);
-  job_t* frontJob = (job_t*)priqueue_poll(readyQueue);
-  
-  if(frontJob != NULL){
-    arr_Cores[core_id] = frontJob;
-    return frontJob->jobNumber;
+  priqueue_t* queue = waitQueue(s, core_id);
+
+  //nothing is waiting, so the job keeps its core without a trip through the queue
+  if(priqueue_size(queue) == 0){
+    sampleImbalance(s);
+    return expiredJob->jobNumber;
+  }
+
+  //every waiting job entered the queue before now, so the head goes first
+  job_t* frontJob = nextJob(s, core_id);
+  setCore(s, core_id, frontJob, time);
+  priqueue_offer(queue, expiredJob);
+  sampleImbalance(s);
+  return frontJob->jobNumber;
+}
+
+int scheduler_quantum_expired(int core_id, int time)
+{
+  return scheduler_quantum_expired_ctx(&defaultScheduler, core_id, time);
+}
+
+
+/*
+Handles the arrivals at the front of events, up to the first other event, and
+returns how many it took. Once no core is idle, an arrival under a scheme that
+never preempts on arrival just joins the shared readyQueue, so all of them are
+offered to it as one batch. Otherwise they go one at a time.
+*/
+static int newJobs(scheduler_t* s, const scheduler_event_t* events, int n, int time, int* decisions)
+{
+  if(s->schem_Curr == PSJF || s->schem_Curr == PPRI || s->coreQueues != NULL || findEmptyCore(s) != -1){
+    decisions[0] = scheduler_new_job_ctx(s, events[0].jobNumber, time, events[0].runningTime, events[0].priority);
+    return 1;
+  }
+
+  int count = 0;
+  while(count < n && events[count].kind == SCHEDULER_JOB_ARRIVED){
+    count++;
+  }
+  if(count > s->batchCapacity){
+    s->batchCapacity = count;
+    s->batch = realloc(s->batch, count * sizeof(void*));
+  }
+  for(int i = 0; i < count; i++){
+    job_t* new_job = makeJob(s, events[i].jobNumber, time, events[i].runningTime, events[i].priority);
+    //as scheduler_new_job() does for every RR arrival
+    if(isPreemptive(s)){
+      new_job->startTime = time;
+    }
+    s->batch[i] = new_job;
+    decisions[i] = -1;
+  }
+  priqueue_offer_batch(&s->readyQueue, s->batch, count);
+  return count;
+}
+
+/**
+  Hands the scheduler every event of one time step at once: completions,
+  quantum expirations and arrivals, in the order the one-at-a-time calls
+  would have been made. Each decision is exactly what that call would have
+  returned, but simultaneous arrivals that all have to wait are queued in one
+  batch.
+
+  @param s the scheduler instance
+  @param events the events, in the order they happened
+  @param n the number of events
+  @param time the current time of the simulator
+  @param decisions filled with n results: for an arrival the core it was put on or -1 (as scheduler_new_job()),
+  otherwise the job now running on the event's core or -1 (as scheduler_job_finished() and scheduler_quantum_expired())
+*/
+void scheduler_process_events_ctx(scheduler_t* s, const scheduler_event_t* events, int n, int time, int* decisions)
+{
+  int i = 0;
+  while(i < n){
+    switch(events[i].kind){
+      case SCHEDULER_JOB_FINISHED:
+        decisions[i] = scheduler_job_finished_ctx(s, events[i].coreId, events[i].jobNumber, time);
+        i++;
+        break;
+      case SCHEDULER_QUANTUM_EXPIRED:
+        decisions[i] = scheduler_quantum_expired_ctx(s, events[i].coreId, time);
+        i++;
+        break;
+      case SCHEDULER_JOB_ARRIVED:
+        i += newJobs(s, events + i, n - i, time, decisions + i);
+        break;
+    }
   }
-	return -1;
+}
+
+void scheduler_process_events(const scheduler_event_t* events, int n, int time, int* decisions)
+{
+  scheduler_process_events_ctx(&defaultScheduler, events, n, time, decisions);
 }
 
 
@@ -472,11 +693,17 @@ int scheduler_quantum_expired(int core_id, int time)
 
   Assumptions:
     - This function will only be called after all scheduling is complete (all jobs that have arrived will have finished and no new jobs will arrive).
+  @param s the scheduler instance
   @return the average waiting time of all jobs scheduled.
  */
+float scheduler_average_waiting_time_ctx(scheduler_t* s)
+{
+	return (((float)histogram_sum(&s->waitTimes)) / ((float)s->totalJobs));
+}
+
 float scheduler_average_waiting_time()
 {
-	return (((float)totalWait) / ((float)totalJobs));
+	return scheduler_average_waiting_time_ctx(&defaultScheduler);
 }
 
 
@@ -485,11 +712,17 @@ float scheduler_average_waiting_time()
 
   Assumptions:
     - This function will only be called after all scheduling is complete (all jobs that have arrived will have finished and no new jobs will arrive).
+  @param s the scheduler instance
   @return the average turnaround time of all jobs scheduled.
  */
+float scheduler_average_turnaround_time_ctx(scheduler_t* s)
+{
+	return (((float)histogram_sum(&s->turnaroundTimes)) / ((float)s->totalJobs));
+}
+
 float scheduler_average_turnaround_time()
 {
-	return (((float)totalTurnaround) / ((float)totalJobs));
+	return scheduler_average_turnaround_time_ctx(&defaultScheduler);
 }
 
 
@@ -498,11 +731,43 @@ float scheduler_average_turnaround_time()
 
   Assumptions:
     - This function will only be called after all scheduling is complete (all jobs that have arrived will have finished and no new jobs will arrive).
+  @param s the scheduler instance
   @return the average response time of all jobs scheduled.
  */
+float scheduler_average_response_time_ctx(scheduler_t* s)
+{
+	return (((float)histogram_sum(&s->responseTimes)) / ((float)s->totalJobs));
+}
+
 float scheduler_average_response_time()
 {
-	return (((float)totalResponse) / ((float)totalJobs));
+	return scheduler_average_response_time_ctx(&defaultScheduler);
+}
+
+
+/**
+  Returns the histogram of one per-job time over every job finished so far,
+  for percentiles (see histogram_percentile()) or to merge with other runs.
+
+  @param s the scheduler instance
+  @param metric which time
+  @return the histogram, owned by the scheduler
+ */
+const histogram_t* scheduler_histogram_ctx(scheduler_t* s, scheduler_metric_t metric)
+{
+  switch(metric){
+    case SCHEDULER_TURNAROUND_TIME:
+          return &s->turnaroundTimes;
+    case SCHEDULER_RESPONSE_TIME:
+          return &s->responseTimes;
+    default:
+          return &s->waitTimes;
+  }
+}
+
+const histogram_t* scheduler_histogram(scheduler_metric_t metric)
+{
+  return scheduler_histogram_ctx(&defaultScheduler, metric);
 }
 
 
@@ -510,15 +775,82 @@ float scheduler_average_response_time()
   Free any memory associated with your scheduler.
  
   Assumption:
-    - This function will be the last function called in your library.
+    - This function will be the last function called on the instance.
+
+  @param s the scheduler instance
 */
+void scheduler_clean_up_ctx(scheduler_t* s)
+{
+  for(int i = 0; i < s->num_Cores; i++){
+    s->arr_Cores[i] = NULL;
+  }
+  free(s->arr_Cores);
+  free(s->idleCores);
+  priqueue_destroy(&s->runningQueue);
+  priqueue_destroy(&s->readyQueue);
+  if(s->coreQueues != NULL){
+    for(int i = 0; i < s->num_Cores; i++){
+      priqueue_destroy(&s->coreQueues[i]);
+    }
+    free(s->coreQueues);
+    s->coreQueues = NULL;
+  }
+  for(int i = 0; i < s->jobs.chunkCount; i++){
+    free(s->jobs.chunks[i]);
+  }
+  free(s->jobs.chunks);
+  s->jobs.chunks = NULL;
+  s->jobs.chunkCount = 0;
+  free(s->batch);
+  s->batch = NULL;
+  s->batchCapacity = 0;
+}
+
 void scheduler_clean_up()
 {
-  for(int i = 0; i < num_Cores; i++){
-    arr_Cores[i] = NULL;
-  }
-  free(arr_Cores);
-  priqueue_destroy(readyQueue);
+  scheduler_clean_up_ctx(&defaultScheduler);
+}
+
+
+/**
+  Turns the scheduler's own trace lines on or off. They are on by default,
+  and scheduler_start_up_ctx() turns them back on.
+
+  @param s the scheduler instance
+  @param verbose nonzero to print them
+*/
+void scheduler_set_verbose_ctx(scheduler_t* s, int verbose)
+{
+  s->traceDecisions = verbose;
+}
+
+void scheduler_set_verbose(int verbose)
+{
+  scheduler_set_verbose_ctx(&defaultScheduler, verbose);
+}
+
+
+/**
+  Reports how the per-core run queues fared (all zero with the shared
+  readyQueue) and how much memory the job records took.
+
+  @param s the scheduler instance
+  @param stats filled in with the steal count, the load imbalance and the job arena counters
+*/
+void scheduler_stats_ctx(scheduler_t* s, scheduler_stats_t* stats)
+{
+  stats->steals = s->steals;
+  stats->maxImbalance = s->maxImbalance;
+  stats->averageImbalance = (s->imbalanceSamples > 0) ? (double)s->imbalanceTotal / s->imbalanceSamples : 0.0;
+  stats->jobBytes = sizeof(job_t);
+  stats->jobsHighWater = s->jobs.highWater;
+  stats->jobsCapacity = s->jobs.chunkCount * JOB_ARENA_CHUNK_JOBS;
+  stats->jobChunks = s->jobs.chunkCount;
+}
+
+void scheduler_stats(scheduler_stats_t* stats)
+{
+  scheduler_stats_ctx(&defaultScheduler, stats);
 }
 
 
@@ -532,47 +864,54 @@ void scheduler_clean_up()
   
   This function is not required and will not be graded. You may leave it
   blank if you do not find it useful.
+
+  @param s the scheduler instance
  */
-void scheduler_show_queue()
+void scheduler_show_queue_ctx(scheduler_t* s)
 {
   printf("CORES: \n");
-  for (int i = 0; i < num_Cores; i++)
+  for (int i = 0; i < s->num_Cores; i++)
   {
-    if (arr_Cores[i] != NULL)
+    if (s->arr_Cores[i] != NULL)
     {
-      printf("  - %d: %d\n", i, arr_Cores[i]->jobNumber);
+      printf("  - %d: %d\n", i, s->arr_Cores[i]->jobNumber);
     }
     else
     {
       printf("  - %d: EMPTY\n", i);
     }
   }
-  printf("PRIORITY QUEUE: \n");
-  for (int i = 0; i < priqueue_size(readyQueue); i++)
+  if (s->coreQueues != NULL)
   {
-    job_t* display = priqueue_at(readyQueue, i);
-    printf("  - [%d] \n", display->jobNumber);
-  }
-}
-
-void scheduler_cores_and_queue()
-{
-  printf("CORES: \n");
-  for (int i = 0; i < num_Cores; i++)
-  {
-    if (arr_Cores[i] != NULL)
-    {
-      printf("  - %d: %d\n", i, arr_Cores[i]->jobNumber);
-    }
-    else
+    for (int i = 0; i < s->num_Cores; i++)
     {
-      printf("  - %d: EMPTY\n", i);
+      printf("RUN QUEUE %d: \n", i);
+      priqueue_iter_t it;
+      priqueue_iter_begin(&s->coreQueues[i], &it);
+      job_t* display;
+      while ((display = priqueue_iter_next(&it)) != NULL)
+      {
+        printf("  - [%d] \n", display->jobNumber);
+      }
     }
+    return;
   }
   printf("PRIORITY QUEUE: \n");
-  for (int i = 0; i < priqueue_size(readyQueue); i++)
+  priqueue_iter_t it;
+  priqueue_iter_begin(&s->readyQueue, &it);
+  job_t* display;
+  while ((display = priqueue_iter_next(&it)) != NULL)
   {
-    job_t* display = priqueue_at(readyQueue, i);
     printf("  - [%d] \n", display->jobNumber);
   }
-}
\ No newline at end of file
+}
+
+void scheduler_show_queue()
+{
+  scheduler_show_queue_ctx(&defaultScheduler);
+}
+
+void scheduler_cores_and_queue()
+{
+  scheduler_show_queue_ctx(&defaultScheduler);
+}
@@ -3,34 +3,133 @@
 
 #ifndef LIBSCHEDULER_H_
 #define LIBSCHEDULER_H_
-//#include "../libpriqueue/libpriqueue.h"
-typedef struct _priqueue_t priqueue_t;
-/*  ZACH DEFINED GLOBALS: */
+#include "../libpriqueue/libpriqueue.h"
+#include "../libhistogram/libhistogram.h"
 
+/**
+  Names a job_t record in a job_arena_t: its chunk in the high bits, its slot
+  in the low JOB_ARENA_CHUNK_BITS.
+*/
+typedef unsigned int job_handle_t;
 
-//GLOBAL QUEUE FOR USE IN SCHEDULING
-priqueue_t* readyQueue;
-//Array of CPU cores to run current job;
-int num_Cores;
+#define JOB_HANDLE_NONE 0xFFFFFFFFu
 
+/**
+  A job record, packed so the links come first and no padding sits between
+  the ints. Records live in a job_arena_t.
+*/
 typedef struct _job_t
 {
+  priqueue_link_t link; //Hooks the job into readyQueue without a separate allocation.
+  priqueue_link_t coreLink; //Hooks a running job into the preemption heap.
   int jobNumber;
   int arrivalTime;
   int startTime;
   int burstTime;
-  int remainBurstTime;
+  int remainBurstTime; //Exact while waiting; while running, as of dispatchTime.
   int priority;
-  int virgin;
-  int reenterTime;
+  union
+  {
+    int reenterTime;
+    job_handle_t nextFree; //Next record on the arena's freelist while this one is free.
+  };
+  int dispatchTime; //Time the job was put on its current core.
+  job_handle_t handle; //The record's own handle, to give it back to the arena.
+  int coreId : 31; //Core the job was last placed on.
+  unsigned int virgin : 1; //Set until the job first gets a core.
 } job_t;
 
-job_t** arr_Cores;
+#define JOB_ARENA_CHUNK_BITS 10
+#define JOB_ARENA_CHUNK_JOBS (1 << JOB_ARENA_CHUNK_BITS)
+
+/**
+  Pool of job_t records. Records are carved out of chunks of
+  JOB_ARENA_CHUNK_JOBS that never move, so pointers held by the queues stay
+  valid, and a finished job's record goes on a freelist for the next arrival
+  instead of back to malloc. Chunks are only freed with the scheduler.
+*/
+typedef struct _job_arena_t
+{
+  job_t** chunks;
+  int chunkCount;
+  int chunkCapacity;
+  job_handle_t freeHead; //First free record, JOB_HANDLE_NONE when every carved record is in use.
+  int carved; //Records handed out at least once; the next fresh one is handle carved.
+  int inUse;
+  int highWater; //Most records in use at once.
+} job_arena_t;
+
 /**
   Constants which represent the different scheduling algorithms
 */
 typedef enum {FCFS = 0, SJF, PSJF, PRI, PPRI, RR} scheme_t;
-scheme_t schem_Curr;
+
+/**
+  Everything one scheduler keeps between calls. Each scheduler_*_ctx()
+  function works on the instance it is given, so any number of them can run
+  side by side in one process; the plain scheduler_*() functions use a single
+  default instance.
+*/
+typedef struct _scheduler_t
+{
+  priqueue_t readyQueue; //Jobs waiting for a core, in the order of the scheme.
+  priqueue_t runningQueue; //Running jobs, the head being the one PSJF/PPRI would preempt first.
+  job_t** arr_Cores; //Job running on each core, NULL while idle.
+  unsigned long long* idleCores; //One bit per core, set while the core is idle.
+  int num_Cores;
+  scheme_t schem_Curr;
+  histogram_t waitTimes; //Of every finished job; the sums give the averages.
+  histogram_t turnaroundTimes;
+  histogram_t responseTimes;
+  int totalJobs;
+  int traceDecisions; //Print the preemption trace in scheduler_new_job, see scheduler_set_verbose().
+  priqueue_t* coreQueues; //Per-core run queues, see scheduler_use_core_queues(); NULL while readyQueue is shared.
+  int stealThreshold; //Fewest jobs a peer must have waiting before an idle core steals from it.
+  long long steals;
+  int maxImbalance;
+  long long imbalanceTotal;
+  long long imbalanceSamples;
+  job_arena_t jobs; //Every job_t the scheduler holds, waiting or running.
+  void** batch; //Arrivals being offered together by scheduler_process_events().
+  int batchCapacity;
+} scheduler_t;
+
+/**
+  Kinds of scheduler_event_t, one per one-at-a-time call.
+*/
+typedef enum {SCHEDULER_JOB_ARRIVED = 0, SCHEDULER_JOB_FINISHED, SCHEDULER_QUANTUM_EXPIRED} scheduler_event_kind_t;
+
+/**
+  One event of a time step for scheduler_process_events(). The fields are the
+  arguments of the matching one-at-a-time call.
+*/
+typedef struct _scheduler_event_t
+{
+  scheduler_event_kind_t kind;
+  int jobNumber; //SCHEDULER_JOB_ARRIVED and SCHEDULER_JOB_FINISHED.
+  int coreId; //SCHEDULER_JOB_FINISHED and SCHEDULER_QUANTUM_EXPIRED.
+  int runningTime; //SCHEDULER_JOB_ARRIVED only.
+  int priority; //SCHEDULER_JOB_ARRIVED only.
+} scheduler_event_t;
+
+/**
+  Per-job times kept by the scheduler, see scheduler_histogram().
+*/
+typedef enum {SCHEDULER_WAITING_TIME = 0, SCHEDULER_TURNAROUND_TIME, SCHEDULER_RESPONSE_TIME} scheduler_metric_t;
+
+/**
+  Counters of the per-core run queues reported by scheduler_stats().
+*/
+typedef struct _scheduler_stats_t
+{
+  long long steals; //Jobs an idle core took from a peer's run queue.
+  int maxImbalance; //Largest gap seen between the longest and the shortest run queue.
+  double averageImbalance; //That gap averaged over every scheduling decision.
+  int jobBytes; //Size of one job record.
+  int jobsHighWater; //Most job records in use at once.
+  int jobsCapacity; //Job records the arena has room for.
+  int jobChunks; //Allocations the arena made for them.
+} scheduler_stats_t;
 
 void  scheduler_start_up               (int cores, scheme_t scheme);
 int   scheduler_new_job                (int job_number, int time, int running_time, int priority);
@@ -42,5 +141,26 @@ float scheduler_average_response_time  ();
 void  scheduler_clean_up               ();
 
 void  scheduler_show_queue             ();
+void  scheduler_set_verbose            (int verbose);
+void  scheduler_use_core_queues        (int steal_threshold);
+void  scheduler_stats                  (scheduler_stats_t *stats);
+void  scheduler_process_events         (const scheduler_event_t *events, int n, int time, int *decisions);
+const histogram_t *scheduler_histogram (scheduler_metric_t metric);
+
+void  scheduler_start_up_ctx               (scheduler_t *s, int cores, scheme_t scheme);
+int   scheduler_new_job_ctx                (scheduler_t *s, int job_number, int time, int running_time, int priority);
+int   scheduler_job_finished_ctx           (scheduler_t *s, int core_id, int job_number, int time);
+int   scheduler_quantum_expired_ctx        (scheduler_t *s, int core_id, int time);
+float scheduler_average_turnaround_time_ctx(scheduler_t *s);
+float scheduler_average_waiting_time_ctx   (scheduler_t *s);
+float scheduler_average_response_time_ctx  (scheduler_t *s);
+void  scheduler_clean_up_ctx               (scheduler_t *s);
+
+void  scheduler_show_queue_ctx             (scheduler_t *s);
+void  scheduler_set_verbose_ctx            (scheduler_t *s, int verbose);
+void  scheduler_use_core_queues_ctx        (scheduler_t *s, int steal_threshold);
+void  scheduler_stats_ctx                  (scheduler_t *s, scheduler_stats_t *stats);
+void  scheduler_process_events_ctx         (scheduler_t *s, const scheduler_event_t *events, int n, int time, int *decisions);
+const histogram_t *scheduler_histogram_ctx (scheduler_t *s, scheduler_metric_t metric);
 
 #endif /* LIBSCHEDULER_H_ */
@@ -0,0 +1,220 @@
+/** @file libtimerwheel.c
+ */
+
+#include <stdlib.h>
+
+#include "libtimerwheel.h"
+
+
+static void link_timer(timerwheel_timer_t **head, timerwheel_timer_t *t)
+{
+  t->next = *head;
+  if (t->next != NULL)
+    t->next->pprev = &t->next;
+  *head = t;
+  t->pprev = head;
+}
+
+static void unlink_timer(timerwheel_t *w, timerwheel_timer_t *t)
+{
+  *t->pprev = t->next;
+  if (t->next != NULL)
+    t->next->pprev = t->pprev;
+
+  if (t->level >= 0 && w->slots[t->level][t->slot] == NULL)
+    w->occupied[t->level] &= ~(1ULL << t->slot);
+
+  t->next = NULL;
+  t->pprev = NULL;
+}
+
+/*
+  Puts a timer in the slot for its expiry as seen from the wheel's current
+  time, or on the due list when that time has already been reached.
+*/
+static void place_timer(timerwheel_t *w, timerwheel_timer_t *t)
+{
+  if (t->expires <= w->now)
+  {
+    t->level = -1;
+    link_timer(&w->due, t);
+    return;
+  }
+
+  unsigned differ = (unsigned)t->expires ^ (unsigned)w->now;
+  int level = (31 - __builtin_clz(differ)) / TIMERWHEEL_SLOT_BITS;
+  int slot = ((unsigned)t->expires >> (level * TIMERWHEEL_SLOT_BITS)) & (TIMERWHEEL_SLOTS - 1);
+
+  t->level = level;
+  t->slot = slot;
+  link_timer(&w->slots[level][slot], t);
+  w->occupied[level] |= 1ULL << slot;
+}
+
+/*
+  Moves every timer of a list onto the end of the fired list.
+*/
+static void fire_timers(timerwheel_t *w, timerwheel_timer_t *list, timerwheel_timer_t ***tail)
+{
+  while (list != NULL)
+  {
+    timerwheel_timer_t *next = list->next;
+
+    list->pprev = NULL;
+    list->next = NULL;
+    **tail = list;
+    *tail = &list->next;
+    w->armed--;
+
+    list = next;
+  }
+}
+
+
+/**
+  Initializes an empty wheel.
+
+  @param w a pointer to an instance of the timerwheel_t data structure
+  @param now the time the wheel starts at
+ */
+void timerwheel_init(timerwheel_t *w, int now)
+{
+  int i, j;
+
+  w->now = now;
+  for (i = 0; i < TIMERWHEEL_LEVELS; i++)
+  {
+    for (j = 0; j < TIMERWHEEL_SLOTS; j++)
+      w->slots[i][j] = NULL;
+    w->occupied[i] = 0;
+  }
+  w->due = NULL;
+  w->armed = 0;
+}
+
+
+/**
+  Arms a timer to fire at a given time, moving it there if it was already
+  armed. A timer that has never been armed must be zeroed first. O(1).
+
+  @param w a pointer to an instance of the timerwheel_t data structure
+  @param t the timer
+  @param expires the time it should fire at
+ */
+void timerwheel_arm(timerwheel_t *w, timerwheel_timer_t *t, int expires)
+{
+  if (t->pprev != NULL)
+    unlink_timer(w, t);
+  else
+    w->armed++;
+
+  t->expires = expires;
+  place_timer(w, t);
+}
+
+
+/**
+  Disarms a timer. Nothing happens if it is not armed. O(1).
+
+  @param w a pointer to an instance of the timerwheel_t data structure
+  @param t the timer
+ */
+void timerwheel_cancel(timerwheel_t *w, timerwheel_timer_t *t)
+{
+  if (t->pprev == NULL)
+    return;
+
+  unlink_timer(w, t);
+  w->armed--;
+}
+
+
+/**
+  Tells whether a timer is armed.
+
+  @param t the timer
+  @return 1 if it is armed, 0 otherwise
+ */
+int timerwheel_is_armed(timerwheel_timer_t *t)
+{
+  return (t->pprev != NULL);
+}
+
+
+/**
+  Moves the wheel's time forward and fires every timer due by then. Only the
+  slots holding timers are visited, so skipping a long stretch of time costs
+  no more than a short one.
+
+  @param w a pointer to an instance of the timerwheel_t data structure
+  @param now the time to advance to; an earlier time than the wheel's only fires the due list
+  @return the fired timers, linked through next in order of expiry (ties in no
+  particular order), or NULL. They are no longer armed and may be armed again
+  right away.
+ */
+timerwheel_timer_t* timerwheel_advance(timerwheel_t *w, int now)
+{
+  timerwheel_timer_t *fired = NULL;
+  timerwheel_timer_t **tail = &fired;
+
+  timerwheel_timer_t *due = w->due;
+  w->due = NULL;
+  fire_timers(w, due, &tail);
+
+  while (1)
+  {
+    int level = 0;
+    while (level < TIMERWHEEL_LEVELS && w->occupied[level] == 0)
+      level++;
+    if (level == TIMERWHEEL_LEVELS)
+      break;
+
+    // Every slot in use lies ahead of the current time at its level, so the
+    // lowest one on the lowest level in use is the next to reach
+    int slot = __builtin_ctzll(w->occupied[level]);
+    int shift = level * TIMERWHEEL_SLOT_BITS;
+    unsigned above = (shift + TIMERWHEEL_SLOT_BITS < 32) ? ((unsigned)w->now >> (shift + TIMERWHEEL_SLOT_BITS)) << (shift + TIMERWHEEL_SLOT_BITS) : 0;
+    int start = (int)(above | ((unsigned)slot << shift));
+
+    if (start > now)
+      break;
+
+    timerwheel_timer_t *list = w->slots[level][slot];
+    w->slots[level][slot] = NULL;
+    w->occupied[level] &= ~(1ULL << slot);
+    w->now = start;
+
+    // Timers expiring at the start of the slot fire, the others move down
+    while (list != NULL)
+    {
+      timerwheel_timer_t *next = list->next;
+
+      if (list->expires == start)
+      {
+        list->next = NULL;
+        fire_timers(w, list, &tail);
+      }
+      else
+        place_timer(w, list);
+
+      list = next;
+    }
+  }
+
+  if (now > w->now)
+    w->now = now;
+
+  return fired;
+}
+
+
+/**
+  Returns the number of armed timers.
+
+  @param w a pointer to an instance of the timerwheel_t data structure
+  @return the number of armed timers
+ */
+int timerwheel_size(timerwheel_t *w)
+{
+  return w->armed;
+}
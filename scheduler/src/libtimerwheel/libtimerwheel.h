@@ -0,0 +1,49 @@
+/** @file libtimerwheel.h
+ */
+
+#ifndef LIBTIMERWHEEL_H_
+#define LIBTIMERWHEEL_H_
+
+#define TIMERWHEEL_SLOT_BITS 6
+#define TIMERWHEEL_SLOTS (1 << TIMERWHEEL_SLOT_BITS)
+#define TIMERWHEEL_LEVELS 6 //Enough levels of TIMERWHEEL_SLOT_BITS for any non-negative int time.
+
+/**
+  A timer, embedded in whatever it times out. It is armed from
+  timerwheel_arm() until it fires or is cancelled.
+*/
+typedef struct _timerwheel_timer_t
+{
+  struct _timerwheel_timer_t* next; //Next timer in the slot, or in the list timerwheel_advance() returns.
+  struct _timerwheel_timer_t** pprev; //Link pointing at this timer, NULL while not armed.
+  int expires; //Time the timer fires at.
+  int level; //Slot the timer sits in, for the occupancy bits.
+  int slot;
+} timerwheel_timer_t;
+
+/**
+  Hierarchical timing wheel. Level 0 has a slot per time unit, and each level
+  above has slots TIMERWHEEL_SLOTS times as wide. A timer sits at the level of
+  the highest base-TIMERWHEEL_SLOTS digit in which its expiry differs from
+  the current time, and moves down a level each time the wheel reaches the
+  start of its slot, so arming and cancelling are O(1) and advancing only
+  touches slots that hold timers.
+*/
+typedef struct _timerwheel_t
+{
+  int now; //Time the wheel has been advanced to.
+  timerwheel_timer_t* slots[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS];
+  unsigned long long occupied[TIMERWHEEL_LEVELS]; //One bit per slot, set while it holds a timer.
+  timerwheel_timer_t* due; //Timers armed for a time already reached.
+  int armed;
+} timerwheel_t;
+
+
+void                timerwheel_init     (timerwheel_t *w, int now);
+void                timerwheel_arm      (timerwheel_t *w, timerwheel_timer_t *t, int expires);
+void                timerwheel_cancel   (timerwheel_t *w, timerwheel_timer_t *t);
+int                 timerwheel_is_armed (timerwheel_timer_t *t);
+timerwheel_timer_t* timerwheel_advance  (timerwheel_t *w, int now);
+int                 timerwheel_size     (timerwheel_t *w);
+
+#endif /* LIBTIMERWHEEL_H_ */
@@ -0,0 +1,736 @@
+/** @file libtrace.c
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "libtrace.h"
+
+#define TRACE_READ_CHUNK (1 << 16)
+
+
+/**
+  Parses one integer field starting at p: optional blanks, an optional sign
+  and at least one digit.
+
+  @return the first character after the number, or NULL with error->reason
+  set if there is no number or it does not fit an int
+ */
+static const char* parse_int(const char *p, const char *end, int *value, trace_error_t *error)
+{
+  int negative = 0;
+  unsigned long long magnitude = 0;
+
+  while (p < end && (*p == ' ' || *p == '\t'))
+    p++;
+
+  if (p < end && (*p == '-' || *p == '+'))
+  {
+    negative = (*p == '-');
+    p++;
+  }
+
+  const char* digits = p;
+  while (p < end && (unsigned)(*p - '0') < 10)
+  {
+    magnitude = magnitude * 10 + (unsigned)(*p - '0');
+    if (magnitude > (unsigned long long)INT_MAX + 1)
+    {
+      error->reason = "number out of range";
+      return NULL;
+    }
+    p++;
+  }
+
+  if (p == digits)
+  {
+    error->reason = "expected a number";
+    return NULL;
+  }
+  if (!negative && magnitude > INT_MAX)
+  {
+    error->reason = "number out of range";
+    return NULL;
+  }
+
+  *value = negative ? (int)-(long long)magnitude : (int)magnitude;
+  return p;
+}
+
+
+/**
+  Skips blanks and expects a ',' after them.
+
+  @return the character after the ',', or NULL with error->reason set
+ */
+static const char* parse_comma(const char *p, const char *end, trace_error_t *error)
+{
+  while (p < end && (*p == ' ' || *p == '\t'))
+    p++;
+
+  if (p == end || *p != ',')
+  {
+    error->reason = "expected three comma separated numbers";
+    return NULL;
+  }
+  return p + 1;
+}
+
+
+/**
+  Parses the line from p to line_end into job.
+
+  @return 1 if the line held a job, 0 if it was blank, or TRACE_BAD_FORMAT
+  with error->reason set
+ */
+static int parse_line(const char *p, const char *line_end, trace_job_t *job, trace_error_t *error)
+{
+  while (p < line_end && (*p == ' ' || *p == '\t' || *p == '\r'))
+    p++;
+
+  if (p == line_end)
+    return 0;
+
+  if ((p = parse_int(p, line_end, &job->arrival_time, error)) == NULL ||
+      (p = parse_comma(p, line_end, error)) == NULL ||
+      (p = parse_int(p, line_end, &job->run_time, error)) == NULL ||
+      (p = parse_comma(p, line_end, error)) == NULL ||
+      (p = parse_int(p, line_end, &job->priority, error)) == NULL)
+    return TRACE_BAD_FORMAT;
+
+  while (p < line_end && (*p == ' ' || *p == '\t' || *p == '\r'))
+    p++;
+  if (p < line_end && *p != ',')
+  {
+    error->reason = "unexpected text after the priority";
+    return TRACE_BAD_FORMAT;
+  }
+
+  return 1;
+}
+
+
+/**
+  Parses a CSV trace held in memory. The first line is a header and is
+  skipped, every other line holds the arrival time, running time and
+  priority of one job. Blank lines are ignored and further columns after the
+  third are allowed. The text is read in place and need not be NUL
+  terminated.
+
+  @param text the contents of the trace
+  @param length number of bytes in text
+  @param jobs set to a malloc()ed array of the jobs, in file order
+  @param count set to the number of jobs
+  @param error filled in when the trace is rejected
+  @return TRACE_OK, TRACE_BAD_FORMAT or TRACE_NO_MEMORY
+ */
+int trace_parse_csv(const char *text, size_t length, trace_job_t **jobs, int *count, trace_error_t *error)
+{
+  const char* p = text;
+  const char* end = text + length;
+  const char* newline;
+  int line = 1;
+
+  // Skip the header
+  newline = memchr(p, '\n', end - p);
+  p = (newline != NULL) ? newline + 1 : end;
+
+  // One job per remaining line at most, so size the array exactly once
+  size_t lines = 0;
+  for (const char* scan = p; scan < end; lines++)
+  {
+    newline = memchr(scan, '\n', end - scan);
+    scan = (newline != NULL) ? newline + 1 : end;
+  }
+
+  if (lines > INT_MAX)
+  {
+    error->line = 0;
+    error->reason = "too many jobs";
+    return TRACE_BAD_FORMAT;
+  }
+
+  trace_job_t* parsed = malloc((lines > 0 ? lines : 1) * sizeof(trace_job_t));
+  if (parsed == NULL)
+  {
+    error->line = 0;
+    error->reason = "out of memory";
+    return TRACE_NO_MEMORY;
+  }
+
+  int n = 0;
+  while (p < end)
+  {
+    const char* line_end = memchr(p, '\n', end - p);
+    if (line_end == NULL)
+      line_end = end;
+    line++;
+
+    error->line = line;
+    int parsed_line = parse_line(p, line_end, &parsed[n], error);
+    if (parsed_line < 0)
+    {
+      free(parsed);
+      return parsed_line;
+    }
+    n += parsed_line;
+
+    p = (line_end < end) ? line_end + 1 : end;
+  }
+
+  *jobs = parsed;
+  *count = n;
+  return TRACE_OK;
+}
+
+
+/**
+  Reads a little endian 32 bit word.
+ */
+static unsigned read_word(const char *p)
+{
+  const unsigned char* b = (const unsigned char*)p;
+  return b[0] | (b[1] << 8) | (b[2] << 16) | ((unsigned)b[3] << 24);
+}
+
+
+/**
+  Writes a little endian 32 bit word.
+ */
+static void write_word(char *p, unsigned word)
+{
+  p[0] = word & 0xff;
+  p[1] = (word >> 8) & 0xff;
+  p[2] = (word >> 16) & 0xff;
+  p[3] = (word >> 24) & 0xff;
+}
+
+
+/**
+  Checks the header of a binary trace, see TRACE_MAGIC for the format.
+
+  @return TRACE_OK, or TRACE_BAD_FORMAT with error->reason set
+ */
+static int parse_header(const char *header, unsigned *flags, unsigned long long *records, unsigned *record_size, trace_error_t *error)
+{
+  unsigned version = read_word(header + 8);
+  *flags = read_word(header + 12);
+  *records = read_word(header + 16) | ((unsigned long long)read_word(header + 20) << 32);
+  *record_size = read_word(header + 24);
+
+  if (version != TRACE_VERSION)
+  {
+    error->reason = "unsupported binary trace version";
+    return TRACE_BAD_FORMAT;
+  }
+  if (*record_size < TRACE_RECORD_SIZE || (*flags & ~TRACE_DELTA_ARRIVALS) != 0)
+  {
+    error->reason = "unsupported binary trace layout";
+    return TRACE_BAD_FORMAT;
+  }
+  if (*records > INT_MAX)
+  {
+    error->reason = "too many jobs";
+    return TRACE_BAD_FORMAT;
+  }
+
+  return TRACE_OK;
+}
+
+
+/**
+  Parses a binary trace held in memory, see TRACE_MAGIC for the format.
+
+  @param data the contents of the trace
+  @param length number of bytes in data
+  @param jobs set to a malloc()ed array of the jobs, in file order
+  @param count set to the number of jobs
+  @param error filled in when the trace is rejected
+  @return TRACE_OK, TRACE_BAD_FORMAT or TRACE_NO_MEMORY
+ */
+int trace_parse_binary(const char *data, size_t length, trace_job_t **jobs, int *count, trace_error_t *error)
+{
+  error->line = 0;
+
+  if (length < TRACE_HEADER_SIZE || memcmp(data, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0)
+  {
+    error->reason = "not a binary trace";
+    return TRACE_BAD_FORMAT;
+  }
+
+  unsigned flags, record_size;
+  unsigned long long records;
+
+  if (parse_header(data, &flags, &records, &record_size, error) != TRACE_OK)
+    return TRACE_BAD_FORMAT;
+
+  if ((length - TRACE_HEADER_SIZE) / record_size < records)
+  {
+    error->reason = "binary trace is truncated";
+    return TRACE_BAD_FORMAT;
+  }
+
+  trace_job_t* parsed = malloc((records > 0 ? records : 1) * sizeof(trace_job_t));
+  if (parsed == NULL)
+  {
+    error->reason = "out of memory";
+    return TRACE_NO_MEMORY;
+  }
+
+  const char* record = data + TRACE_HEADER_SIZE;
+  unsigned arrival = 0;
+  for (int i = 0; i < (int)records; i++, record += record_size)
+  {
+    arrival = (flags & TRACE_DELTA_ARRIVALS) ? arrival + read_word(record) : read_word(record);
+    parsed[i].arrival_time = (int)arrival;
+    parsed[i].run_time = (int)read_word(record + 4);
+    parsed[i].priority = (int)read_word(record + 8);
+  }
+
+  *jobs = parsed;
+  *count = (int)records;
+  return TRACE_OK;
+}
+
+
+/**
+  Writes jobs out as a binary trace, see TRACE_MAGIC for the format.
+
+  @param out where to write the trace
+  @param jobs the jobs, in the order they should be read back
+  @param count number of jobs
+  @param flags 0 or TRACE_DELTA_ARRIVALS
+  @return TRACE_OK or TRACE_WRITE_FAILED
+ */
+int trace_write_binary(FILE *out, const trace_job_t *jobs, int count, unsigned flags)
+{
+  char header[TRACE_HEADER_SIZE];
+  char record[TRACE_RECORD_SIZE];
+  unsigned previous = 0;
+
+  memset(header, 0, sizeof(header));
+  memcpy(header, TRACE_MAGIC, TRACE_MAGIC_SIZE);
+  write_word(header + 8, TRACE_VERSION);
+  write_word(header + 12, flags);
+  write_word(header + 16, (unsigned)count);
+  write_word(header + 24, TRACE_RECORD_SIZE);
+
+  if (fwrite(header, sizeof(header), 1, out) != 1)
+    return TRACE_WRITE_FAILED;
+
+  for (int i = 0; i < count; i++)
+  {
+    unsigned arrival = (unsigned)jobs[i].arrival_time;
+    write_word(record, (flags & TRACE_DELTA_ARRIVALS) ? arrival - previous : arrival);
+    write_word(record + 4, (unsigned)jobs[i].run_time);
+    write_word(record + 8, (unsigned)jobs[i].priority);
+    previous = arrival;
+
+    if (fwrite(record, sizeof(record), 1, out) != 1)
+      return TRACE_WRITE_FAILED;
+  }
+
+  return TRACE_OK;
+}
+
+
+/**
+  Gets the whole contents of a file. Regular files are mapped into memory,
+  anything else, such as a pipe, is read into a malloc()ed buffer.
+
+  @param mapped set to nonzero when the contents must be released with
+  munmap() rather than free()
+  @return TRACE_OK, TRACE_OPEN_FAILED or TRACE_NO_MEMORY
+ */
+static int read_file(const char *file_name, char **contents, size_t *length, int *mapped, trace_error_t *error)
+{
+  struct stat info;
+
+  error->line = 0;
+
+  int fd = (strcmp(file_name, "-") == 0) ? dup(STDIN_FILENO) : open(file_name, O_RDONLY);
+  if (fd == -1 || fstat(fd, &info) == -1)
+  {
+    error->reason = strerror(errno);
+    if (fd != -1)
+      close(fd);
+    return TRACE_OPEN_FAILED;
+  }
+
+  if (S_ISREG(info.st_mode) && info.st_size > 0)
+  {
+    char* text = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED)
+    {
+      error->reason = strerror(errno);
+      return TRACE_OPEN_FAILED;
+    }
+
+    madvise(text, info.st_size, MADV_SEQUENTIAL);
+    *contents = text;
+    *length = info.st_size;
+    *mapped = 1;
+    return TRACE_OK;
+  }
+
+  size_t used = 0, capacity = TRACE_READ_CHUNK;
+  char* text = malloc(capacity);
+  ssize_t got;
+
+  while (text != NULL && (got = read(fd, text + used, capacity - used)) != 0)
+  {
+    if (got < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      error->reason = strerror(errno);
+      free(text);
+      close(fd);
+      return TRACE_OPEN_FAILED;
+    }
+
+    used += got;
+    if (used == capacity)
+    {
+      char* grown = realloc(text, capacity * 2);
+      if (grown == NULL)
+        free(text);
+      text = grown;
+      capacity *= 2;
+    }
+  }
+  close(fd);
+
+  if (text == NULL)
+  {
+    error->reason = "out of memory";
+    return TRACE_NO_MEMORY;
+  }
+
+  *contents = text;
+  *length = used;
+  *mapped = 0;
+  return TRACE_OK;
+}
+
+
+/**
+  Releases what read_file() returned.
+ */
+static void release_file(char *contents, size_t length, int mapped)
+{
+  if (mapped)
+    munmap(contents, length);
+  else
+    free(contents);
+}
+
+
+/**
+  Loads a trace from a file, telling binary traces (see TRACE_MAGIC) and
+  CSV traces (see trace_parse_csv()) apart by their first bytes.
+
+  @param file_name the file to load, "-" for standard input
+  @param jobs set to a malloc()ed array of the jobs, in file order
+  @param count set to the number of jobs
+  @param error filled in when the trace is rejected
+  @return TRACE_OK, TRACE_OPEN_FAILED, TRACE_BAD_FORMAT or TRACE_NO_MEMORY
+ */
+int trace_load(const char *file_name, trace_job_t **jobs, int *count, trace_error_t *error)
+{
+  char* contents;
+  size_t length;
+  int mapped;
+
+  int result = read_file(file_name, &contents, &length, &mapped, error);
+  if (result != TRACE_OK)
+    return result;
+
+  if (length >= TRACE_MAGIC_SIZE && memcmp(contents, TRACE_MAGIC, TRACE_MAGIC_SIZE) == 0)
+    result = trace_parse_binary(contents, length, jobs, count, error);
+  else
+    result = trace_parse_csv(contents, length, jobs, count, error);
+
+  release_file(contents, length, mapped);
+  return result;
+}
+
+
+/**
+  Loads a CSV trace (see trace_parse_csv()) from a file. Regular files are
+  mapped into memory and parsed in place; anything else, such as a pipe, is
+  read into memory first.
+
+  @param file_name the file to load, "-" for standard input
+  @param jobs set to a malloc()ed array of the jobs, in file order
+  @param count set to the number of jobs
+  @param error filled in when the trace is rejected
+  @return TRACE_OK, TRACE_OPEN_FAILED, TRACE_BAD_FORMAT or TRACE_NO_MEMORY
+ */
+int trace_load_csv(const char *file_name, trace_job_t **jobs, int *count, trace_error_t *error)
+{
+  char* contents;
+  size_t length;
+  int mapped;
+
+  int result = read_file(file_name, &contents, &length, &mapped, error);
+  if (result != TRACE_OK)
+    return result;
+
+  result = trace_parse_csv(contents, length, jobs, count, error);
+  release_file(contents, length, mapped);
+  return result;
+}
+
+
+/**
+  Loads a binary trace (see TRACE_MAGIC) from a file, mapping it into memory
+  when it is a regular file.
+
+  @param file_name the file to load, "-" for standard input
+  @param jobs set to a malloc()ed array of the jobs, in file order
+  @param count set to the number of jobs
+  @param error filled in when the trace is rejected
+  @return TRACE_OK, TRACE_OPEN_FAILED, TRACE_BAD_FORMAT or TRACE_NO_MEMORY
+ */
+int trace_load_binary(const char *file_name, trace_job_t **jobs, int *count, trace_error_t *error)
+{
+  char* contents;
+  size_t length;
+  int mapped;
+
+  int result = read_file(file_name, &contents, &length, &mapped, error);
+  if (result != TRACE_OK)
+    return result;
+
+  result = trace_parse_binary(contents, length, jobs, count, error);
+  release_file(contents, length, mapped);
+  return result;
+}
+
+
+/**
+  Makes sure at least need bytes are buffered from r->start on, unless the
+  file ends first.
+
+  @return TRACE_OK, TRACE_OPEN_FAILED on a read error or TRACE_NO_MEMORY
+ */
+static int reader_fill(trace_reader_t *r, size_t need, trace_error_t *error)
+{
+  while (r->end - r->start < need && !r->eof)
+  {
+    if (r->start > 0)
+    {
+      memmove(r->buffer, r->buffer + r->start, r->end - r->start);
+      r->end -= r->start;
+      r->start = 0;
+    }
+
+    if (r->end + TRACE_READ_CHUNK > r->capacity)
+    {
+      size_t capacity = (r->capacity > 0) ? r->capacity * 2 : 2 * TRACE_READ_CHUNK;
+      char* grown = realloc(r->buffer, capacity);
+      if (grown == NULL)
+      {
+        error->reason = "out of memory";
+        return TRACE_NO_MEMORY;
+      }
+      r->buffer = grown;
+      r->capacity = capacity;
+    }
+
+    size_t got = fread(r->buffer + r->end, 1, r->capacity - r->end, r->file);
+    r->end += got;
+    if (got == 0)
+    {
+      if (ferror(r->file))
+      {
+        error->reason = strerror(errno);
+        return TRACE_OPEN_FAILED;
+      }
+      r->eof = 1;
+    }
+  }
+
+  return TRACE_OK;
+}
+
+
+/**
+  Opens a trace for reading one job at a time with trace_reader_next(), so
+  only a small window of it is ever held in memory. Binary traces (see
+  TRACE_MAGIC) and CSV traces (see trace_parse_csv()) are told apart by
+  their first bytes.
+
+  @param r a pointer to an instance of the trace_reader_t data structure
+  @param file_name the file to read, "-" for standard input
+  @param error filled in when the trace cannot be read
+  @return TRACE_OK, TRACE_OPEN_FAILED, TRACE_BAD_FORMAT or TRACE_NO_MEMORY
+ */
+int trace_reader_open(trace_reader_t *r, const char *file_name, trace_error_t *error)
+{
+  FILE* file = stdin;
+
+  if (strcmp(file_name, "-") != 0 && (file = fopen(file_name, "rb")) == NULL)
+  {
+    memset(r, 0, sizeof(*r));
+    error->line = 0;
+    error->reason = strerror(errno);
+    return TRACE_OPEN_FAILED;
+  }
+
+  int result = trace_reader_open_file(r, file, error);
+  if (result == TRACE_OK)
+    r->own_file = (file != stdin);
+  else if (file != stdin)
+    fclose(file);
+  return result;
+}
+
+
+/**
+  Like trace_reader_open(), but reads a file that is already open, from its
+  current position on. trace_reader_close() leaves the file open, so the
+  caller can seek back and read the trace again.
+
+  @param r a pointer to an instance of the trace_reader_t data structure
+  @param file the file to read
+  @param error filled in when the trace cannot be read
+  @return TRACE_OK, TRACE_OPEN_FAILED, TRACE_BAD_FORMAT or TRACE_NO_MEMORY
+ */
+int trace_reader_open_file(trace_reader_t *r, FILE *file, trace_error_t *error)
+{
+  int result;
+
+  memset(r, 0, sizeof(*r));
+  error->line = 0;
+  r->file = file;
+
+  if ((result = reader_fill(r, TRACE_HEADER_SIZE, error)) != TRACE_OK)
+  {
+    trace_reader_close(r);
+    return result;
+  }
+
+  if (r->end >= TRACE_MAGIC_SIZE && memcmp(r->buffer, TRACE_MAGIC, TRACE_MAGIC_SIZE) == 0)
+  {
+    if (r->end < TRACE_HEADER_SIZE)
+    {
+      error->reason = "binary trace is truncated";
+      trace_reader_close(r);
+      return TRACE_BAD_FORMAT;
+    }
+    if (parse_header(r->buffer, &r->flags, &r->remaining, &r->record_size, error) != TRACE_OK)
+    {
+      trace_reader_close(r);
+      return TRACE_BAD_FORMAT;
+    }
+
+    r->binary = 1;
+    r->start = TRACE_HEADER_SIZE;
+    return TRACE_OK;
+  }
+
+  // Skip the header line of a CSV trace
+  trace_job_t header;
+  result = trace_reader_next(r, &header, error);
+  if (result < 0)
+  {
+    trace_reader_close(r);
+    return result;
+  }
+  return TRACE_OK;
+}
+
+
+/**
+  Reads the next job of a trace opened with trace_reader_open().
+
+  @param r a pointer to an instance of the trace_reader_t data structure
+  @param job filled in with the next job
+  @param error filled in when the trace is rejected
+  @return 1 when a job was read, 0 at the end of the trace, or one of
+  TRACE_OPEN_FAILED, TRACE_BAD_FORMAT and TRACE_NO_MEMORY
+ */
+int trace_reader_next(trace_reader_t *r, trace_job_t *job, trace_error_t *error)
+{
+  int result;
+
+  if (r->binary)
+  {
+    error->line = 0;
+    if (r->remaining == 0)
+      return 0;
+
+    if ((result = reader_fill(r, r->record_size, error)) != TRACE_OK)
+      return result;
+    if (r->end - r->start < r->record_size)
+    {
+      error->reason = "binary trace is truncated";
+      return TRACE_BAD_FORMAT;
+    }
+
+    const char* record = r->buffer + r->start;
+    r->arrival = (r->flags & TRACE_DELTA_ARRIVALS) ? r->arrival + read_word(record) : read_word(record);
+    job->arrival_time = (int)r->arrival;
+    job->run_time = (int)read_word(record + 4);
+    job->priority = (int)read_word(record + 8);
+
+    r->start += r->record_size;
+    r->remaining--;
+    return 1;
+  }
+
+  while (1)
+  {
+    size_t scanned = 0;
+    const char* newline;
+
+    while ((newline = memchr(r->buffer + r->start + scanned, '\n', r->end - r->start - scanned)) == NULL && !r->eof)
+    {
+      scanned = r->end - r->start;
+      if ((result = reader_fill(r, scanned + 1, error)) != TRACE_OK)
+        return result;
+    }
+
+    if (r->start == r->end)
+      return 0;
+
+    const char* line = r->buffer + r->start;
+    const char* line_end = (newline != NULL) ? newline : r->buffer + r->end;
+    r->start = (newline != NULL) ? (size_t)(newline + 1 - r->buffer) : r->end;
+
+    error->line = ++r->line;
+    if (r->line == 1)
+      return 1;
+
+    result = parse_line(line, line_end, job, error);
+    if (result != 0)
+      return result;
+  }
+}
+
+
+/**
+  Closes a trace opened with trace_reader_open() and frees its buffer.
+
+  @param r a pointer to an instance of the trace_reader_t data structure
+ */
+void trace_reader_close(trace_reader_t *r)
+{
+  if (r->file != NULL && r->own_file)
+    fclose(r->file);
+
+  free(r->buffer);
+  r->file = NULL;
+  r->buffer = NULL;
+}
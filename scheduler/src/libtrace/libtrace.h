@@ -0,0 +1,86 @@
+/** @file libtrace.h
+ */
+
+#ifndef LIBTRACE_H_
+#define LIBTRACE_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+  One job of a trace, in the order the trace lists them.
+*/
+typedef struct _trace_job_t
+{
+  int arrival_time;
+  int run_time;
+  int priority;
+} trace_job_t;
+
+/**
+  Where and why a trace could not be read, filled in by the trace_* loaders.
+*/
+typedef struct _trace_error_t
+{
+  int line; //Line of the file at fault, 0 when the problem is not tied to one.
+  const char* reason;
+} trace_error_t;
+
+#define TRACE_OK            0
+#define TRACE_OPEN_FAILED  -1
+#define TRACE_BAD_FORMAT   -2
+#define TRACE_NO_MEMORY    -3
+#define TRACE_WRITE_FAILED -4
+
+/**
+  Binary trace format, all fields little endian:
+    - a TRACE_HEADER_SIZE byte header: the 8 byte TRACE_MAGIC, then 32 bit
+      version, flags, job count (low word first as two 32 bit words),
+      record size and a reserved zero word;
+    - one TRACE_RECORD_SIZE byte record per job: 32 bit arrival time,
+      running time and priority.
+  With TRACE_DELTA_ARRIVALS set, each arrival time is stored as the
+  difference from the previous job's (the first from 0), which keeps the
+  values small, and the file easy to compress, for sorted traces.
+*/
+#define TRACE_MAGIC "SCHTRACE"
+#define TRACE_MAGIC_SIZE 8
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 32
+#define TRACE_RECORD_SIZE 12
+#define TRACE_DELTA_ARRIVALS 0x1
+
+/**
+  Reads a trace one job at a time, see trace_reader_open().
+*/
+typedef struct _trace_reader_t
+{
+  FILE* file;
+  int own_file; //Whether trace_reader_close() closes file.
+  char* buffer; //Bytes read ahead of the parser, the unread ones from start to end.
+  size_t start;
+  size_t end;
+  size_t capacity;
+  int eof;
+  int line; //Lines read so far (CSV traces only).
+  int binary;
+  unsigned flags; //Header fields of a binary trace.
+  unsigned record_size;
+  unsigned long long remaining; //Records left to read (binary traces only).
+  unsigned arrival; //Arrival time of the last record, for TRACE_DELTA_ARRIVALS.
+} trace_reader_t;
+
+
+int trace_load       (const char *file_name, trace_job_t **jobs, int *count, trace_error_t *error);
+int trace_load_csv   (const char *file_name, trace_job_t **jobs, int *count, trace_error_t *error);
+int trace_load_binary(const char *file_name, trace_job_t **jobs, int *count, trace_error_t *error);
+int trace_parse_csv   (const char *text, size_t length, trace_job_t **jobs, int *count, trace_error_t *error);
+int trace_parse_binary(const char *data, size_t length, trace_job_t **jobs, int *count, trace_error_t *error);
+int trace_write_binary(FILE *out, const trace_job_t *jobs, int count, unsigned flags);
+
+int  trace_reader_open (trace_reader_t *r, const char *file_name, trace_error_t *error);
+int  trace_reader_open_file(trace_reader_t *r, FILE *file, trace_error_t *error);
+int  trace_reader_next (trace_reader_t *r, trace_job_t *job, trace_error_t *error);
+void trace_reader_close(trace_reader_t *r);
+
+#endif /* LIBTRACE_H_ */
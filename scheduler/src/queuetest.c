@@ -3,6 +3,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
 
 #include "libpriqueue/libpriqueue.h"
 
@@ -16,6 +18,18 @@ int compare2(const void * a, const void * b)
 	return ( *(int*)b - *(int*)a );
 }
 
+typedef struct
+{
+	int id, weight;
+} weighted_t;
+
+PRIQUEUE_DEFINE_TYPED(heaviest_first, weighted_t, weight, >)
+
+int int_key(const void * a)
+{
+	return *(int*)a;
+}
+
 int main()
 {
 	priqueue_t q, q2;
@@ -64,9 +78,180 @@ int main()
 		printf("%d ", *((int *)priqueue_at(&q2, i)) );
 	printf("\n");
 
+	priqueue_iter_t it;
+	int *elem;
+	printf("Elements iterated in order (expected 10 13 14 20 30): ");
+	priqueue_iter_begin(&q, &it);
+	while ((elem = priqueue_iter_next(&it)) != NULL)
+		printf("%d ", *elem);
+	printf("\n");
+
 	priqueue_destroy(&q2);
 	priqueue_destroy(&q);
 
+	/* Same checks against the heap backend. */
+	priqueue_t h;
+	priqueue_init_backend(&h, compare1, PRIQUEUE_HEAP);
+
+	priqueue_offer(&h, &values[12]);
+	priqueue_offer(&h, &values[13]);
+	priqueue_offer(&h, &values[14]);
+	priqueue_offer(&h, &values[12]);
+	priqueue_offer(&h, &values[12]);
+	printf("Heap total elements: %d (expected 5).\n", priqueue_size(&h));
+
+	val = *((int *)priqueue_poll(&h));
+	printf("Heap top element: %d (expected 12).\n", val);
+
+	vals_removed = priqueue_remove(&h, &values[12]);
+	printf("Heap elements removed: %d (expected 2).\n", vals_removed);
+
+	priqueue_offer(&h, &values[30]);
+	priqueue_offer(&h, &values[10]);
+	priqueue_offer(&h, &values[20]);
+
+	printf("Heap elements in order (expected 10 13 14 20 30): ");
+	for (i = 0; i < priqueue_size(&h); i++)
+		printf("%d ", *((int *)priqueue_at(&h, i)) );
+	printf("\n");
+
+	printf("Heap iterated in order (expected 10 13 14 20 30): ");
+	priqueue_iter_begin(&h, &it);
+	while ((elem = priqueue_iter_next(&it)) != NULL)
+		printf("%d ", *elem);
+	printf("\n");
+
+	/* Equal elements must come back first in, first out. */
+	int same[3] = { 7, 7, 7 };
+	priqueue_offer(&h, &same[0]);
+	priqueue_offer(&h, &same[1]);
+	priqueue_offer(&h, &same[2]);
+	printf("Heap ties in FIFO order (expected 0 1 2): ");
+	while (priqueue_size(&h) > 0)
+	{
+		int *p = priqueue_poll(&h);
+		if (p >= same && p < same + 3)
+			printf("%d ", (int)(p - same));
+	}
+	printf("\n");
+
+	priqueue_stats_t stats;
+	for (i = 0; i < 1000; i++)
+	{
+		priqueue_offer(&h, &values[i % 100]);
+		priqueue_poll(&h);
+	}
+	priqueue_stats(&h, &stats);
+	printf("Heap nodes in use after churn: %d (expected 0).\n", stats.nodes_in_use);
+	printf("Heap node high-water mark: %d (expected 8).\n", stats.nodes_high_water);
+
+	priqueue_destroy(&h);
+
+	/* Bucket queues index elements by an integer key. */
+	priqueue_t b;
+	priqueue_init_backend(&b, compare1, PRIQUEUE_BUCKET);
+	priqueue_set_key(&b, int_key);
+	priqueue_offer(&b, &values[40]);
+	priqueue_offer(&b, &values[3]);
+	priqueue_offer(&b, &values[90]);
+	priqueue_offer(&b, &values[3]);
+	priqueue_offer(&b, &values[0]);
+	printf("Bucket elements removed: %d (expected 2).\n", priqueue_remove(&b, &values[3]));
+	priqueue_offer(&b, &values[70]);
+	printf("Bucket elements in order (expected 0 40 70 90): ");
+	while (priqueue_size(&b) > 0)
+		printf("%d ", *((int *)priqueue_poll(&b)));
+	printf("\n");
+	priqueue_destroy(&b);
+
+	/* Keys spread too far apart for the ring move the queue to a keyed heap. */
+	int wide[5] = { 1, 1000000000, 3, -2000000000, 2000000000 };
+	priqueue_init_backend(&b, compare1, PRIQUEUE_BUCKET);
+	priqueue_set_key(&b, int_key);
+	for (i = 0; i < 5; i++)
+		priqueue_offer(&b, &wide[i]);
+	printf("Wide bucket keys in order (expected -2000000000 1 3 1000000000 2000000000): ");
+	while (priqueue_size(&b) > 0)
+		printf("%d ", *((int *)priqueue_poll(&b)));
+	printf("\n");
+	priqueue_destroy(&b);
+
+	/* Typed specializations inline the comparison on one member. */
+	weighted_t weighted[4] = { {0, 5}, {1, 9}, {2, 5}, {3, 1} };
+	priqueue_init_backend(&h, heaviest_first, PRIQUEUE_HEAP);
+	priqueue_set_typed(&h, &heaviest_first_typed);
+	for (i = 0; i < 4; i++)
+		priqueue_offer(&h, &weighted[i]);
+	printf("Typed heap ids in order (expected 1 0 2 3): ");
+	while (priqueue_size(&h) > 0)
+		printf("%d ", ((weighted_t *)priqueue_poll(&h))->id);
+	printf("\n");
+	priqueue_destroy(&h);
+
+	/* A batch offer is rebuilt bottom-up but keeps the order of single offers. */
+	weighted_t batch[6] = { {0, 2}, {1, 7}, {2, 2}, {3, 7}, {4, 4}, {5, 2} };
+	void *batch_ptrs[6];
+	priqueue_init_backend(&h, heaviest_first, PRIQUEUE_KEYED_HEAP);
+	priqueue_set_typed(&h, &heaviest_first_typed);
+	priqueue_offer(&h, &batch[0]);
+	for (i = 1; i < 6; i++)
+		batch_ptrs[i - 1] = &batch[i];
+	priqueue_offer_batch(&h, batch_ptrs, 5);
+	printf("Batch heap ids in order (expected 1 3 4 0 2 5): ");
+	while (priqueue_size(&h) > 0)
+		printf("%d ", ((weighted_t *)priqueue_poll(&h))->id);
+	printf("\n");
+	priqueue_destroy(&h);
+
+	/* Largest-first keys hold the whole int range. */
+	weighted_t extremes[4] = { {0, INT_MIN}, {1, INT_MAX}, {2, 0}, {3, INT_MIN} };
+	priqueue_init_backend(&h, heaviest_first, PRIQUEUE_KEYED_HEAP);
+	priqueue_set_typed(&h, &heaviest_first_typed);
+	for (i = 0; i < 4; i++)
+		priqueue_offer(&h, &extremes[i]);
+	printf("Extreme keys ids in order (expected 1 2 0 3): ");
+	while (priqueue_size(&h) > 0)
+		printf("%d ", ((weighted_t *)priqueue_poll(&h))->id);
+	printf("\n");
+	priqueue_destroy(&h);
+
+	/* Handles reposition an element after its key changes. */
+	int keys[4] = { 40, 10, 30, 20 };
+	priqueue_handle_t handles[4];
+	priqueue_init_backend(&h, compare1, PRIQUEUE_HEAP);
+	for (i = 0; i < 4; i++)
+		handles[i] = priqueue_offer_handle(&h, &keys[i]);
+	keys[0] = 5;
+	priqueue_update(&h, handles[0]);
+	keys[1] = 35;
+	priqueue_update(&h, handles[1]);
+	printf("Handle removed: %d (expected 30).\n", *((int *)priqueue_remove_handle(&h, handles[2])));
+	printf("Heap after updates (expected 5 20 35): ");
+	while (priqueue_size(&h) > 0)
+		printf("%d ", *((int *)priqueue_poll(&h)));
+	printf("\n");
+	priqueue_destroy(&h);
+
+	/* Intrusive queues link elements through an embedded priqueue_link_t. */
+	typedef struct { int value; priqueue_link_t link; } item_t;
+	item_t items[5];
+	priqueue_t iq;
+	priqueue_init_intrusive(&iq, compare1, PRIQUEUE_LIST, offsetof(item_t, link));
+	for (i = 0; i < 5; i++)
+	{
+		items[i].value = (i * 3) % 5;
+		priqueue_offer(&iq, &items[i]);
+	}
+	printf("Intrusive elements removed: %d (expected 1).\n", priqueue_remove(&iq, &items[2]));
+	printf("Intrusive elements removed again: %d (expected 0).\n", priqueue_remove(&iq, &items[2]));
+	printf("Intrusive elements in order (expected 0 2 3 4): ");
+	while (priqueue_size(&iq) > 0)
+		printf("%d ", ((item_t *)priqueue_poll(&iq))->value);
+	printf("\n");
+	priqueue_stats(&iq, &stats);
+	printf("Intrusive nodes allocated: %d (expected 0).\n", stats.nodes_capacity);
+	priqueue_destroy(&iq);
+
 	free(values);
 
 	return 0;
@@ -8,121 +8,1468 @@
 #include <unistd.h>
 #include <string.h>
 #include <assert.h>
+#include <stddef.h>
+#include <limits.h>
+#include <getopt.h>
+#include <pthread.h>
 
 #include "libscheduler/libscheduler.h"
+#include "libdiagram/libdiagram.h"
+#include "libtrace/libtrace.h"
+#include "libtimerwheel/libtimerwheel.h"
 
 
+/*
+ * How much the simulator prints, selected with -v (-q is -v 0). Each level
+ * adds to the ones below it.
+ */
+enum
+{
+	VERBOSITY_METRICS = 0,  // the three averages
+	VERBOSITY_SUMMARY,      // the header line and the final timing diagram
+	VERBOSITY_EVENTS,       // every arrival, completion and quantum expiry
+	VERBOSITY_TICKS         // the diagram and queue after every time unit
+};
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
 typedef struct _simulator_job_list_t
 {
-	int job_id, arrival_time, run_time, priority;
-	int core_id, arrived;
-} simulator_job_list_t;
+	int job_id, arrival_time, run_time, priority;
+	int core_id, arrived;
+} simulator_job_list_t;
+
+/*
+ * A job that has not arrived yet. The loaded jobs are sorted on these once so
+ * each time unit only looks at the jobs arriving in it.
+ */
+typedef struct _simulator_pending_t
+{
+	int arrival_time, job_id;
+	int slot; // its slot in jobs[], filled in once it is due
+} simulator_pending_t;
+
+int compare_pending(const void *a, const void *b)
+{
+	const simulator_pending_t *x = a, *y = b;
+
+	if (x->arrival_time != y->arrival_time)
+		return (x->arrival_time < y->arrival_time) ? -1 : 1;
+	return x->job_id - y->job_id;
+}
+
+int compare_pending_slots(const void *a, const void *b)
+{
+	return ((const simulator_pending_t *)a)->slot - ((const simulator_pending_t *)b)->slot;
+}
+
+/*
+ * A point in time at which the job on a core finishes or runs out of
+ * quantum. Used by the event-driven mode (-e) to jump over the time units
+ * in between.
+ */
+typedef struct _simulator_event_t
+{
+	int time;
+	int changed; // the job or quantum of the core changed since time was worked out
+	priqueue_link_t link;
+} simulator_event_t;
+
+int compare_events(const void *a, const void *b)
+{
+	return ((const simulator_event_t *)a)->time - ((const simulator_event_t *)b)->time;
+}
+
+int event_time(const void *a)
+{
+	return ((const simulator_event_t *)a)->time;
+}
+
+void print_usage(char *program_name)
+{
+	fprintf(stderr, "Usage: %s [-e] [-S] [-m] [-p] [-q | -v <level>] [-d <segments file>] [-w <threshold>] -c <cores> -s <scheme> <input file>\n", program_name);
+	fprintf(stderr, "       %s --sweep [-j <threads>] [-w <threshold>] -c <cores,...> -s <scheme,...> <input file>\n", program_name);
+	fprintf(stderr, "       %s -c 2 -s fcfs examples/proc1.csv\n", program_name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Acceptable schemes are: fcfs, sjf, psjf, pri, ppri, rr#\n");
+	fprintf(stderr, "The input file is a CSV trace or a binary trace made with csv2trace, - for stdin.\n");
+	fprintf(stderr, "  -e  event-driven: jump straight from one arrival, completion or quantum\n");
+	fprintf(stderr, "      expiry to the next instead of stepping every time unit. Only the\n");
+	fprintf(stderr, "      event messages are printed along the way; results are identical.\n");
+	fprintf(stderr, "  -S  stream the trace: read jobs as they arrive instead of loading them all\n");
+	fprintf(stderr, "      first, holding only the live ones and the slot of each job a loaded\n");
+	fprintf(stderr, "      run would have moved before it arrives. The trace must be sorted by\n");
+	fprintf(stderr, "      arrival time. The results are the same as without -S. A CSV trace is\n");
+	fprintf(stderr, "      read through once first to count its jobs, stdin from a temporary\n");
+	fprintf(stderr, "      copy if it is a pipe.\n");
+	fprintf(stderr, "  -m  print how much memory the job records took before the averages: bytes\n");
+	fprintf(stderr, "      per record, most records live at once and records allocated.\n");
+	fprintf(stderr, "  -p  print the waiting, turnaround and response time percentiles (p50,\n");
+	fprintf(stderr, "      p90, p99, p99.9 and max) before the averages.\n");
+	fprintf(stderr, "  -v  how much to print: 0 averages only, 1 adds the final timing diagram,\n");
+	fprintf(stderr, "      2 adds every event, 3 adds the state after every time unit (default).\n");
+	fprintf(stderr, "  -q  same as -v 0.\n");
+	fprintf(stderr, "  -d  also write the timing diagram to a file as CSV segments\n");
+	fprintf(stderr, "      (core, job, start, length), one per stretch a core ran one job.\n");
+	fprintf(stderr, "  -w  give every core its own run queue; a core with none left steals from\n");
+	fprintf(stderr, "      the longest peer queue once it holds at least <threshold> jobs.\n");
+	fprintf(stderr, "      Steal counts and queue imbalance are printed before the averages.\n");
+	fprintf(stderr, "  --sweep  run every combination of the core counts and schemes listed\n");
+	fprintf(stderr, "      with -c and -s over the trace, which is read once, and print one CSV\n");
+	fprintf(stderr, "      row of metrics, p99 times included, per combination. Lists are comma\n");
+	fprintf(stderr, "      separated and may hold ranges, e.g. -c 1,2,4..8 -s fcfs,sjf,rr1..rr16.\n");
+	fprintf(stderr, "  -j  threads to run a sweep on (default: one per online CPU).\n");
+}
+
+/*
+ * Where each unfinished job sits in jobs[], by job_id: an open addressing
+ * hash table with linear probing, kept at most half full. Only jobs that are
+ * still in jobs[] are in it, so when streaming it holds just the live ones.
+ */
+typedef struct _simulator_job_index_t
+{
+	int *ids, *slots;
+	int capacity, size;
+} simulator_job_index_t;
+
+#define JOB_INDEX_EMPTY -1
+
+int job_index_home(simulator_job_index_t *index, int job_id)
+{
+	return (int)(((unsigned)job_id * 2654435761u) & (unsigned)(index->capacity - 1));
+}
+
+int job_index_init(simulator_job_index_t *index, int expected)
+{
+	int i;
+
+	index->capacity = 16;
+	while (index->capacity < 2 * expected)
+		index->capacity *= 2;
+	index->size = 0;
+	index->ids = malloc(index->capacity * sizeof(int));
+	index->slots = malloc(index->capacity * sizeof(int));
+
+	if (index->ids == NULL || index->slots == NULL)
+		return -1;
+
+	for (i = 0; i < index->capacity; i++)
+		index->ids[i] = JOB_INDEX_EMPTY;
+	return 0;
+}
+
+int job_index_get(simulator_job_index_t *index, int job_id)
+{
+	int i = job_index_home(index, job_id);
+
+	while (index->ids[i] != JOB_INDEX_EMPTY)
+	{
+		if (index->ids[i] == job_id)
+			return index->slots[i];
+		i = (i + 1) & (index->capacity - 1);
+	}
+
+	return -1;
+}
+
+int job_index_set(simulator_job_index_t *index, int job_id, int slot)
+{
+	int i;
+
+	if (2 * (index->size + 1) > index->capacity)
+	{
+		simulator_job_index_t grown;
+		if (job_index_init(&grown, index->capacity) != 0)
+			return -1;
+
+		for (i = 0; i < index->capacity; i++)
+			if (index->ids[i] != JOB_INDEX_EMPTY)
+				job_index_set(&grown, index->ids[i], index->slots[i]);
+
+		free(index->ids);
+		free(index->slots);
+		*index = grown;
+	}
+
+	i = job_index_home(index, job_id);
+	while (index->ids[i] != JOB_INDEX_EMPTY && index->ids[i] != job_id)
+		i = (i + 1) & (index->capacity - 1);
+
+	if (index->ids[i] == JOB_INDEX_EMPTY)
+		index->size++;
+	index->ids[i] = job_id;
+	index->slots[i] = slot;
+	return 0;
+}
+
+void job_index_remove(simulator_job_index_t *index, int job_id)
+{
+	int mask = index->capacity - 1;
+	int hole = job_index_home(index, job_id);
+
+	while (index->ids[hole] != job_id)
+	{
+		if (index->ids[hole] == JOB_INDEX_EMPTY)
+			return;
+		hole = (hole + 1) & mask;
+	}
+
+	// Shift back the entries after it that would no longer be found
+	int next = hole;
+	while (1)
+	{
+		next = (next + 1) & mask;
+		if (index->ids[next] == JOB_INDEX_EMPTY)
+			break;
+
+		int home = job_index_home(index, index->ids[next]);
+		if (((next - home) & mask) >= ((next - hole) & mask))
+		{
+			index->ids[hole] = index->ids[next];
+			index->slots[hole] = index->slots[next];
+			hole = next;
+		}
+	}
+
+	index->ids[hole] = JOB_INDEX_EMPTY;
+	index->size--;
+}
+
+void job_index_destroy(simulator_job_index_t *index)
+{
+	free(index->ids);
+	free(index->slots);
+}
+
+void print_trace_error(char *file_name, int result, trace_error_t *error)
+{
+	if (result == TRACE_OPEN_FAILED)
+		fprintf(stderr, "Unable to open file \"%s\".\n", file_name);
+	else if (result == TRACE_NO_MEMORY)
+		fprintf(stderr, "Out of memory.\n");
+	else if (error->line > 0)
+		fprintf(stderr, "Illegal file format on line %d of \"%s\": %s.\n", error->line, file_name, error->reason);
+	else
+		fprintf(stderr, "Illegal file format in \"%s\": %s.\n", file_name, error->reason);
+}
+
+/*
+ * Opens a trace to stream and counts its jobs, as a streamed run follows the
+ * slots a loaded one would use (see stream_finish()) and those depend on how
+ * many jobs there are. A binary trace says in its header; a CSV one is read
+ * through once first. Standard input is copied to a temporary file for that
+ * unless it can seek. file is what reader reads, for the caller to close.
+ * Returns 0, or -1 after saying why the trace cannot be streamed.
+ */
+int open_stream(trace_reader_t *reader, char *file_name, FILE **file, int *count)
+{
+	trace_error_t error;
+	trace_job_t job;
+	int result = 0;
+
+	*file = stdin;
+	if (strcmp(file_name, "-") != 0 && (*file = fopen(file_name, "rb")) == NULL)
+	{
+		print_trace_error(file_name, TRACE_OPEN_FAILED, &error);
+		return -1;
+	}
+
+	long start = ftell(*file);
+	if (start < 0)
+	{
+		FILE *spool = tmpfile();
+		char buffer[1 << 16];
+		size_t length;
+
+		if (spool == NULL)
+		{
+			fprintf(stderr, "Unable to copy \"%s\" to a temporary file.\n", file_name);
+			return -1;
+		}
+		while ((length = fread(buffer, 1, sizeof(buffer), *file)) > 0)
+			if (fwrite(buffer, 1, length, spool) != length)
+				break;
+		if (ferror(*file) || ferror(spool))
+		{
+			fprintf(stderr, "Unable to copy \"%s\" to a temporary file.\n", file_name);
+			fclose(spool);
+			return -1;
+		}
+		*file = spool;
+		start = 0;
+		fseek(spool, 0, SEEK_SET);
+	}
+
+	if ((result = trace_reader_open_file(reader, *file, &error)) != TRACE_OK)
+	{
+		print_trace_error(file_name, result, &error);
+		return -1;
+	}
+
+	unsigned long long jobs = reader->remaining;
+	if (!reader->binary)
+		while ((result = trace_reader_next(reader, &job, &error)) == 1)
+			jobs++;
+	trace_reader_close(reader);
+
+	if (result < 0)
+	{
+		print_trace_error(file_name, result, &error);
+		return -1;
+	}
+	if (jobs > INT_MAX)
+	{
+		error.line = 0;
+		error.reason = "too many jobs";
+		print_trace_error(file_name, TRACE_BAD_FORMAT, &error);
+		return -1;
+	}
+	*count = (int)jobs;
+
+	// Back to the first job for the run itself
+	if (fseek(*file, start, SEEK_SET) != 0)
+	{
+		print_trace_error(file_name, TRACE_OPEN_FAILED, &error);
+		return -1;
+	}
+	if ((result = trace_reader_open_file(reader, *file, &error)) != TRACE_OK)
+	{
+		print_trace_error(file_name, result, &error);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Reads the next job of a streamed trace. Returns 1 when there is one, 0 at
+ * the end of the trace and -1, after saying why, when the trace is bad or
+ * not sorted by arrival time.
+ */
+int stream_next_job(trace_reader_t *reader, char *file_name, trace_job_t *next)
+{
+	trace_error_t error;
+	int last_arrival = next->arrival_time;
+	int result = trace_reader_next(reader, next, &error);
+
+	if (result < 0)
+	{
+		print_trace_error(file_name, result, &error);
+		return -1;
+	}
+
+	if (result == 1 && next->arrival_time < last_arrival)
+	{
+		error.reason = "jobs must be sorted by arrival time to be streamed";
+		print_trace_error(file_name, TRACE_BAD_FORMAT, &error);
+		return -1;
+	}
+
+	return result;
+}
+
+void print_available_jobs(FILE *out, simulator_job_list_t *jobs, int active_jobs)
+{
+	fprintf(out, "Active jobs are: ");
+
+	int i, first = 1;
+	for (i = 0; i < active_jobs; i++)
+	{
+		if (jobs[i].arrived)
+		{
+			if (first)
+			{
+				fprintf(out, "%d", jobs[i].job_id);
+				first = 0;
+			}
+			else
+				fprintf(out, ", %d", jobs[i].job_id);
+		}
+	}
+
+	if (!first)
+		fprintf(out, "\n");
+}
+
+void print_percentiles(const char *name, const histogram_t *times)
+{
+	printf("%s Time Percentiles: p50 %lld, p90 %lld, p99 %lld, p99.9 %lld, max %lld\n", name,
+			histogram_percentile(times, 50.0), histogram_percentile(times, 90.0), histogram_percentile(times, 99.0),
+			histogram_percentile(times, 99.9), histogram_max(times));
+}
+
+void print_available_cores(FILE *out, int cores)
+{
+	fprintf(out, "Active cores are: ");
+
+	int i;
+	for (i = 0; i < cores; i++)
+	{
+		if (i == cores - 1)
+			fprintf(out, "%d\n", i);
+		else
+			fprintf(out, "%d, ", i);
+	}
+}
+
+
+/*
+ * Reads a scheme the way -s takes it: fcfs, sjf, psjf, pri, ppri or rr
+ * followed by its quantum. Returns 0 on success, -1 for an unknown scheme and
+ * -2 for RR without a positive quantum.
+ */
+int parse_scheme(const char *name, int *scheme, int *quantum)
+{
+	*quantum = 0;
+
+	if (strcasecmp(name, "FCFS") == 0) { *scheme = FCFS; }
+	else if (strcasecmp(name, "SJF") == 0) { *scheme = SJF; }
+	else if (strcasecmp(name, "PSJF") == 0) { *scheme = PSJF; }
+	else if (strcasecmp(name, "PRI") == 0) { *scheme = PRI; }
+	else if (strcasecmp(name, "PPRI") == 0) { *scheme = PPRI; }
+	else if (strncasecmp(name, "RR", 2) == 0)
+	{
+		*scheme = RR;
+		*quantum = atoi(name + 2);
+
+		if (*quantum <= 0)
+			return -2;
+	}
+	else
+		return -1;
+
+	return 0;
+}
+
+const char *scheme_name(int scheme)
+{
+	static const char *names[] = { "fcfs", "sjf", "psjf", "pri", "ppri", "rr" };
+	return names[scheme];
+}
+
+
+/*
+ * One run of the simulation. The caller fills in the settings and the jobs,
+ * either a loaded trace (only read, so runs can share it) or an open reader
+ * whose first job is already in next_job, then calls simulate(). The results
+ * are read off scheduler, diagram, time and busy_units afterwards, and
+ * simulate_destroy() frees the rest whatever simulate() returned.
+ */
+typedef struct _simulator_run_t
+{
+	int cores, scheme, quantum;
+	int event_driven, verbosity, keep_diagram;
+	int steal_threshold; // per-core run queues when > 0, see scheduler_use_core_queues()
+	FILE *errors; // where a scheduler that went wrong is reported: stdout, or stderr in a sweep
+
+	const trace_job_t *trace;
+	int trace_count;
+	trace_reader_t *reader; // NULL unless streaming
+	char *file_name;
+	trace_job_t next_job;
+	int stream_pending;
+	int stream_count; // jobs in the streamed trace, see open_stream()
+
+	scheduler_t scheduler;
+	diagram_t diagram;
+	int time, jobs_read;
+	long long busy_units; // time units the cores spent running a job, summed over cores
+
+	simulator_job_list_t *jobs;
+	simulator_job_index_t job_slot;
+	int *core_job, *finished_slots, *expired_cores;
+	timerwheel_t quantum_wheel; // RR only: a timer per busy core for the end of its quantum
+	timerwheel_timer_t *quantum_timers;
+	simulator_pending_t *pending;
+	priqueue_t events;
+	simulator_event_t *core_events;
+	int *changed_cores; // event-driven only: the cores whose event has to be worked out again
+	int loaded_active; // streaming only: active_jobs of a loaded run, see stream_finish()
+	simulator_job_index_t loaded_slots, loaded_jobs;
+	int changed_count;
+	scheduler_event_t *batch; // events of the time unit not yet handed to the scheduler
+	int *decisions; // what the scheduler made of each of them
+	int batch_count, batch_capacity;
+} simulator_run_t;
+
+/*
+ * Appends an event for the scheduler to the batch of the current time unit.
+ * Returns NULL when memory runs out.
+ */
+scheduler_event_t *add_event(simulator_run_t *run, scheduler_event_kind_t kind, int job_id, int core_id)
+{
+	if (run->batch_count == run->batch_capacity)
+	{
+		int capacity = (run->batch_capacity > 0) ? run->batch_capacity * 2 : 16;
+		scheduler_event_t *batch = realloc(run->batch, capacity * sizeof(scheduler_event_t));
+		if (batch == NULL)
+			return NULL;
+		run->batch = batch;
+
+		int *decisions = realloc(run->decisions, capacity * sizeof(int));
+		if (decisions == NULL)
+			return NULL;
+		run->decisions = decisions;
+		run->batch_capacity = capacity;
+	}
+
+	scheduler_event_t *event = &run->batch[run->batch_count++];
+	event->kind = kind;
+	event->jobNumber = job_id;
+	event->coreId = core_id;
+	return event;
+}
+
+/*
+ * Notes that the job on a core changed, or its quantum was restarted, so
+ * the event-driven mode works out its next event again. The cores left
+ * alone keep theirs, as the times in them are absolute.
+ */
+void core_changed(simulator_run_t *run, int core_id)
+{
+	if (run->event_driven && !run->core_events[core_id].changed)
+	{
+		run->core_events[core_id].changed = 1;
+		run->changed_cores[run->changed_count++] = core_id;
+	}
+}
+
+/*
+ * The slot a streamed job would have in jobs[] had the trace been loaded:
+ * its job_id, unless stream_finish() moved it.
+ */
+int loaded_slot(simulator_run_t *run, int job_id)
+{
+	int slot = job_index_get(&run->loaded_slots, job_id);
+	return (slot == -1) ? job_id : slot;
+}
+
+/*
+ * A loaded run starts out with every job in jobs[], fills the slot of a
+ * finished job with the one in the last slot, arrived or not, and hands the
+ * jobs finishing or arriving in the same time unit over in slot order. A
+ * streamed run keeps to that order by following the slots: loaded_slots
+ * maps the job_id of each job moved so far, read yet or not, to its slot
+ * and loaded_jobs maps the slot back. Called for each finished job in turn.
+ * Returns -1 when memory runs out.
+ */
+int stream_finish(simulator_run_t *run, int job_id)
+{
+	int slot = loaded_slot(run, job_id);
+	int last = --run->loaded_active;
+
+	job_index_remove(&run->loaded_slots, job_id);
+	job_index_remove(&run->loaded_jobs, slot);
+	if (slot == last)
+		return 0;
+
+	// The last slot still holds the job it started with unless one was moved there
+	int moved = job_index_get(&run->loaded_jobs, last);
+	if (moved == -1)
+		moved = last;
+	else
+		job_index_remove(&run->loaded_jobs, last);
+
+	if (job_index_set(&run->loaded_slots, moved, slot) != 0 || job_index_set(&run->loaded_jobs, slot, moved) != 0)
+		return -1;
+	return 0;
+}
+
+/*
+ * core_job[core_id] is the job_id running on a core (-1 while idle), kept in
+ * step with jobs[] and job_slot so no step has to search jobs[].
+ */
+int set_active_job(simulator_run_t *run, int job_id, int core_id)
+{
+	int slot = job_index_get(&run->job_slot, job_id);
+
+	if (slot == -1 || !run->jobs[slot].arrived)
+		return 0;
+
+	simulator_job_list_t *job = &run->jobs[slot];
+	if (job->core_id != -1 && run->core_job[job->core_id] == job_id)
+	{
+		run->core_job[job->core_id] = -1;
+		core_changed(run, job->core_id);
+	}
+
+	job->core_id = core_id;
+	run->core_job[core_id] = job_id;
+	core_changed(run, core_id);
+	return 1;
+}
+
+/*
+ * Hands the batched events to the scheduler in one call and carries out its
+ * decisions in the order the events happened. The bookkeeping that does not
+ * depend on a decision (a finished job leaving jobs[], an arrival joining
+ * it) is done as the events are collected. Returns 0, or 3 after saying
+ * which call misbehaved.
+ */
+int run_events(simulator_run_t *run, int time, int active_jobs)
+{
+	int k, count = run->batch_count;
+	simulator_job_list_t *jobs = run->jobs;
+	simulator_job_index_t *job_slot = &run->job_slot;
+	int *core_job = run->core_job;
+	scheduler_t *scheduler = &run->scheduler;
+	int verbosity = run->verbosity;
+
+	if (count == 0)
+		return 0;
+
+	run->batch_count = 0;
+	scheduler_process_events_ctx(scheduler, run->batch, count, time, run->decisions);
+
+	for (k = 0; k < count; k++)
+	{
+		scheduler_event_t *event = &run->batch[k];
+		int core_id = event->coreId;
+		int decision = run->decisions[k];
+
+		if (event->kind == SCHEDULER_JOB_FINISHED)
+		{
+			if (run->scheme == RR && decision != -1)
+				timerwheel_arm(&run->quantum_wheel, &run->quantum_timers[core_id], time + run->quantum);
+
+			// Set the new job
+			if ( decision != -1 && !set_active_job(run, decision, core_id) )
+			{
+				fprintf(run->errors, "The scheduler_job_finished() selected an invalid job (job_id == %d).\n", decision);
+				print_available_jobs(run->errors, jobs, active_jobs);
+				return 3;
+			}
+			else if (verbosity >= VERBOSITY_EVENTS)
+			{
+				printf("Job %d, running on core %d, finished. Core %d is now running job %d.\n", event->jobNumber, core_id, core_id, decision);
+				printf("  Queue: "); scheduler_show_queue_ctx(scheduler); printf("\n\n");
+			}
+		}
+		else if (event->kind == SCHEDULER_QUANTUM_EXPIRED)
+		{
+			int old_job_id = core_job[core_id];
+			jobs[job_index_get(job_slot, old_job_id)].core_id = -1;
+			core_job[core_id] = -1;
+			core_changed(run, core_id);
+
+			if (decision != -1)
+				timerwheel_arm(&run->quantum_wheel, &run->quantum_timers[core_id], time + run->quantum);
+
+			// Set the new job
+			if ( decision != -1 && !set_active_job(run, decision, core_id) )
+			{
+				fprintf(run->errors, "The scheduler_quantum_expired() selected an invalid job (job_id == %d).\n", decision);
+				print_available_jobs(run->errors, jobs, active_jobs);
+				return 3;
+			}
+			else if (verbosity >= VERBOSITY_EVENTS)
+			{
+				printf("Job %d, running on core %d, had its quantum expire. Core %d is now running job %d.\n", old_job_id, core_id, core_id, decision);
+				printf("  Queue: "); scheduler_show_queue_ctx(scheduler); printf("\n\n");
+			}
+		}
+		else if (decision >= 0 && decision < run->cores)
+		{
+			if (verbosity >= VERBOSITY_EVENTS)
+			{
+				printf("A new job, job %d (running time=%d, priority=%d), arrived. Job %d is now running on core %d.\n",
+						event->jobNumber, event->runningTime, event->priority, event->jobNumber, decision);
+				printf("  Queue: "); scheduler_show_queue_ctx(scheduler); printf("\n\n");
+			}
+
+			// Find if anyone is currently using the core.
+			if (core_job[decision] != -1)
+				jobs[job_index_get(job_slot, core_job[decision])].core_id = -1;
+
+			// Assign the core to the new job
+			jobs[job_index_get(job_slot, event->jobNumber)].core_id = decision;
+			core_job[decision] = event->jobNumber;
+			core_changed(run, decision);
+
+			if (run->scheme == RR)
+				timerwheel_arm(&run->quantum_wheel, &run->quantum_timers[decision], time + run->quantum);
+		}
+		else if (decision == -1)
+		{
+			if (verbosity >= VERBOSITY_EVENTS)
+			{
+				printf("A new job, job %d (running time=%d, priority=%d), arrived. Job %d is set to idle (-1).\n",
+						event->jobNumber, event->runningTime, event->priority, event->jobNumber);
+				printf("  Queue: "); scheduler_show_queue_ctx(scheduler); printf("\n\n");
+			}
+		}
+		else
+		{
+			fprintf(run->errors, "The scheduler_new_job() selected an invalid core (core_id == %d).\n", decision);
+			print_available_cores(run->errors, run->cores);
+			return 3;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Runs the jobs of run through its scheduler until the last one finishes.
+ * Returns 0 on success, 2 when the trace cannot be read or memory runs out
+ * and 3 when the scheduler misbehaves, after saying so.
+ */
+int simulate(simulator_run_t *run)
+{
+	int i, j, result;
+	int cores = run->cores, scheme = run->scheme;
+	int event_driven = run->event_driven, verbosity = run->verbosity;
+	int streaming = (run->reader != NULL);
+	int job_id = streaming ? 0 : run->trace_count;
+	scheduler_t *scheduler = &run->scheduler;
+	diagram_t *core_timing_diagram = &run->diagram;
+	simulator_job_index_t *job_slot = &run->job_slot;
+
+	scheduler_start_up_ctx(scheduler, cores, scheme);
+	scheduler_set_verbose_ctx(scheduler, verbosity >= VERBOSITY_EVENTS);
+	if (run->steal_threshold > 0)
+		scheduler_use_core_queues_ctx(scheduler, run->steal_threshold);
+	diagram_init(core_timing_diagram, cores);
+
+	/*
+	 * In event-driven mode every busy core has an event for whichever comes
+	 * first of its job finishing or its quantum expiring, in a min-heap on
+	 * time. Only the cores listed by core_changed() get theirs worked out
+	 * again. The next arrival is pending[next_pending].
+	 */
+	if (event_driven)
+	{
+		priqueue_init_intrusive(&run->events, compare_events, PRIQUEUE_KEYED_HEAP, offsetof(simulator_event_t, link));
+		priqueue_set_key(&run->events, event_time);
+	}
+
+	int jobs_capacity = (job_id > 0) ? job_id : 16;
+	simulator_job_list_t *jobs = run->jobs = malloc(jobs_capacity * sizeof(simulator_job_list_t));
+	int *core_job = run->core_job = malloc(cores * sizeof(int));
+	int *finished_slots = run->finished_slots = malloc(cores * sizeof(int));
+	int *expired_cores = run->expired_cores = malloc(cores * sizeof(int));
+	timerwheel_t *quantum_wheel = &run->quantum_wheel;
+	timerwheel_timer_t *quantum_timers = run->quantum_timers = calloc(cores, sizeof(timerwheel_timer_t));
+	int pending_capacity = streaming ? 16 : job_id;
+	simulator_pending_t *pending = run->pending = malloc(pending_capacity * sizeof(simulator_pending_t));
+	priqueue_t *events = &run->events;
+	simulator_event_t *core_events = NULL;
+	int *changed_cores = NULL;
+	if (event_driven)
+	{
+		core_events = run->core_events = calloc(cores, sizeof(simulator_event_t));
+		changed_cores = run->changed_cores = malloc(cores * sizeof(int));
+	}
+	run->changed_count = 0;
+	run->batch = NULL;
+	run->decisions = NULL;
+	run->batch_count = run->batch_capacity = 0;
+
+	if (job_index_init(job_slot, job_id) != 0 || !jobs || !core_job || !finished_slots || !expired_cores || !quantum_timers ||
+	    (pending_capacity > 0 && !pending) || (event_driven && (!core_events || !changed_cores)) ||
+	    (streaming && (job_index_init(&run->loaded_slots, 0) != 0 || job_index_init(&run->loaded_jobs, 0) != 0)))
+	{
+		fprintf(stderr, "Out of memory.\n");
+		return 2;
+	}
+
+	for (i = 0; i < job_id; i++)
+	{
+		jobs[i].job_id = i;
+		jobs[i].arrival_time = run->trace[i].arrival_time;
+		jobs[i].run_time = run->trace[i].run_time;
+		jobs[i].priority = run->trace[i].priority;
+		jobs[i].core_id = -1;
+		jobs[i].arrived = 0;
+	}
+
+	/*
+	 * When streaming, jobs are only read as they arrive. next_job is the next
+	 * one due, while stream_pending says there is one, and job_id counts the
+	 * jobs read so far.
+	 */
+	trace_job_t next_job = run->next_job;
+	int stream_pending = streaming ? run->stream_pending : 0;
+	run->loaded_active = run->stream_count;
+
+
+	int time = 0;
+	int active_jobs = job_id, jobs_alive = 0;
+	int job_id_count = job_id;
+	int keep_diagram = run->keep_diagram;
+
+	for (i = 0; i < job_id; i++)
+		job_index_set(job_slot, i, i);
+
+	for (i = 0; i < cores; i++)
+		core_job[i] = -1;
+
+	timerwheel_init(quantum_wheel, 0);
+
+	/*
+	 * Jobs yet to arrive, by arrival time. pending[next_pending] is the next
+	 * one due; everything before it has arrived.
+	 */
+	int next_pending = 0;
+
+	for (i = 0; i < job_id; i++)
+	{
+		pending[i].arrival_time = jobs[i].arrival_time;
+		pending[i].job_id = jobs[i].job_id;
+	}
+	qsort(pending, job_id, sizeof(simulator_pending_t), compare_pending);
+
+	/*
+	 * The events of a time unit are collected and handed to the scheduler in
+	 * one call by run_events(). When every event is printed along with the
+	 * queue it leaves behind, they are handed over one at a time instead.
+	 */
+	int batch_events = (verbosity < VERBOSITY_EVENTS);
+
+	while (active_jobs > 0 || stream_pending)
+	{
+		if (verbosity >= VERBOSITY_EVENTS)
+			printf("=== [TIME %d] ===\n", time);
+
+		/*
+		 * 1. Check if any jobs finished in the last time unit. Only a job on a
+		 *    core can have run out, and they are handled in the order of their
+		 *    slots in jobs[] as that is the order the scheduler has always been
+		 *    told about them. Streamed jobs go by the slots they would have in
+		 *    a loaded run instead.
+		 */
+		int finished_count = 0;
+		for (i = 0; i < cores; i++)
+			if (core_job[i] != -1 && jobs[job_index_get(job_slot, core_job[i])].run_time == 0)
+				finished_slots[finished_count++] = job_index_get(job_slot, core_job[i]);
+
+		while (finished_count > 0)
+		{
+			int first = 0;
+			for (j = 1; j < finished_count; j++)
+			{
+				if (streaming ? loaded_slot(run, jobs[finished_slots[j]].job_id) < loaded_slot(run, jobs[finished_slots[first]].job_id)
+				              : finished_slots[j] < finished_slots[first])
+					first = j;
+			}
+
+			i = finished_slots[first];
+			finished_slots[first] = finished_slots[--finished_count];
+
+			// Notify the scheduler has finished
+			int job_id = jobs[i].job_id;
+			int core_id = jobs[i].core_id;
+			if (add_event(run, SCHEDULER_JOB_FINISHED, job_id, core_id) == NULL)
+			{
+				fprintf(stderr, "Out of memory.\n");
+				return 2;
+			}
+
+			// Re-armed by run_events() if the core gets a new job
+			if (scheme == RR)
+				timerwheel_cancel(quantum_wheel, &quantum_timers[core_id]);
+
+			core_job[core_id] = -1;
+			core_changed(run, core_id);
+			job_index_remove(job_slot, job_id);
+			if (streaming && stream_finish(run, job_id) != 0)
+			{
+				fprintf(stderr, "Out of memory.\n");
+				return 2;
+			}
+
+			// Delete the finished jobs, decrease the number of active jobs
+			if (i != active_jobs - 1)
+			{
+				memcpy(&jobs[i], &jobs[active_jobs - 1], sizeof(simulator_job_list_t));
+				job_index_set(job_slot, jobs[i].job_id, i);
+
+				for (j = 0; j < finished_count; j++)
+					if (finished_slots[j] == active_jobs - 1)
+						finished_slots[j] = i;
+			}
+			active_jobs--;
+			jobs_alive--;
+
+			if (!batch_events && (result = run_events(run, time, active_jobs)) != 0)
+				return result;
+		}
+
+		/*
+		 * Check to see if we finished our last job.  (If we don't check here, we would run an extra time unit that will be totally idle.)
+		 */
+		if (active_jobs == 0 && !stream_pending)
+		{
+			if ((result = run_events(run, time, active_jobs)) != 0)
+				return result;
+			break;
+		}
+
+		/*
+		 * 2. Check of any quantums expired in the last time unit. Only the
+		 *    timers due now fire, and their cores are handled in core id
+		 *    order as a scan over the cores would meet them.
+		 */
+		if (scheme == RR)
+		{
+			int expired_count = 0;
+			timerwheel_timer_t *timer;
+			for (timer = timerwheel_advance(quantum_wheel, time); timer != NULL; timer = timer->next)
+			{
+				int core = timer - quantum_timers;
+				for (j = expired_count++; j > 0 && expired_cores[j - 1] > core; j--)
+					expired_cores[j] = expired_cores[j - 1];
+				expired_cores[j] = core;
+			}
+
+			for (int k = 0; k < expired_count; k++)
+			{
+				// Notify the scheduler the quantum has expired
+				if (add_event(run, SCHEDULER_QUANTUM_EXPIRED, core_job[expired_cores[k]], expired_cores[k]) == NULL)
+				{
+					fprintf(stderr, "Out of memory.\n");
+					return 2;
+				}
+
+				if (!batch_events && (result = run_events(run, time, active_jobs)) != 0)
+					return result;
+			}
+		}
+
+
+		/*
+		 * 3. Check for any new jobs that arrive in this time unit. Jobs arriving
+		 *    together are handed over in the order of their slots in jobs[],
+		 *    the order a scan of jobs[] would meet them in. Streamed jobs only
+		 *    join jobs[] now, and pending[] just holds the ones read for this
+		 *    time unit, with the slots they would have in a loaded run.
+		 */
+		int arriving = next_pending;
+		if (streaming)
+		{
+			arriving = next_pending = 0;
+			while (stream_pending && next_job.arrival_time <= time)
+			{
+				if (active_jobs == jobs_capacity)
+				{
+					jobs_capacity *= 2;
+					jobs = realloc(jobs, jobs_capacity * sizeof(simulator_job_list_t));
+
+					if (!jobs)
+					{
+						fprintf(stderr, "Out of memory.\n");
+						return 2;
+					}
+					run->jobs = jobs;
+				}
+
+				if (next_pending == pending_capacity)
+				{
+					pending_capacity *= 2;
+					pending = realloc(pending, pending_capacity * sizeof(simulator_pending_t));
+
+					if (!pending)
+					{
+						fprintf(stderr, "Out of memory.\n");
+						return 2;
+					}
+					run->pending = pending;
+				}
+
+				i = active_jobs++;
+				jobs[i].job_id = job_id++;
+				jobs[i].arrival_time = next_job.arrival_time;
+				jobs[i].run_time = next_job.run_time;
+				jobs[i].priority = next_job.priority;
+				jobs[i].core_id = -1;
+				jobs[i].arrived = 0;
+
+				if (job_index_set(job_slot, jobs[i].job_id, i) != 0)
+				{
+					fprintf(stderr, "Out of memory.\n");
+					return 2;
+				}
+
+				pending[next_pending].arrival_time = jobs[i].arrival_time;
+				pending[next_pending].job_id = jobs[i].job_id;
+				pending[next_pending++].slot = loaded_slot(run, jobs[i].job_id);
+
+				if ((stream_pending = stream_next_job(run->reader, run->file_name, &next_job)) < 0)
+					return 2;
+			}
+		}
+		else
+		{
+			while (next_pending < job_id_count && pending[next_pending].arrival_time <= time)
+			{
+				pending[next_pending].slot = job_index_get(job_slot, pending[next_pending].job_id);
+				next_pending++;
+			}
+		}
+		if (next_pending - arriving > 1)
+			qsort(&pending[arriving], next_pending - arriving, sizeof(simulator_pending_t), compare_pending_slots);
+
+		while (arriving != next_pending)
+		{
+			i = job_index_get(job_slot, pending[arriving++].job_id);
+
+			scheduler_event_t *event = add_event(run, SCHEDULER_JOB_ARRIVED, jobs[i].job_id, -1);
+			if (event == NULL)
+			{
+				fprintf(stderr, "Out of memory.\n");
+				return 2;
+			}
+			event->runningTime = jobs[i].run_time;
+			event->priority = jobs[i].priority;
+			jobs[i].arrived = 1;
+			jobs_alive++;
+
+			if (!batch_events && (result = run_events(run, time, active_jobs)) != 0)
+				return result;
+		}
+
+		if ((result = run_events(run, time, active_jobs)) != 0)
+			return result;
+
+
+		/*
+		 * 4. Run the time unit. In event-driven mode, run every unit up to the
+		 *    next event at once: nothing changes hands in between.
+		 */
+		int units = 1;
+
+		if (event_driven)
+		{
+			simulator_event_t *event;
+			for (j = 0; j < run->changed_count; j++)
+			{
+				i = changed_cores[j];
+				core_events[i].changed = 0;
+				core_events[i].time = INT_MAX;
+
+				if (core_job[i] != -1)
+				{
+					int next = time + jobs[job_index_get(job_slot, core_job[i])].run_time;
+					if (scheme == RR && quantum_timers[i].expires < next)
+						next = quantum_timers[i].expires;
+					core_events[i].time = next;
+				}
+
+				priqueue_handle_t handle = priqueue_handle_of(events, &core_events[i]);
+				if (core_events[i].time == INT_MAX)
+				{
+					if (handle != NULL)
+						priqueue_remove_handle(events, handle);
+				}
+				else if (handle != NULL)
+					priqueue_update(events, handle);
+				else if (priqueue_offer(events, &core_events[i]) < 0)
+				{
+					fprintf(stderr, "Out of memory.\n");
+					return 2;
+				}
+			}
+			run->changed_count = 0;
+
+			int next = INT_MAX;
+			if ((event = priqueue_peek(events)) != NULL)
+				next = event->time;
+			if (next_pending < job_id_count && pending[next_pending].arrival_time < next)
+				next = pending[next_pending].arrival_time;
+			if (stream_pending && next_job.arrival_time < next)
+				next = next_job.arrival_time;
+
+			if (next != INT_MAX)
+				units = next - time;
+		}
+
+		int cores_working = 0;
+
+		for (i = 0; i < cores; i++)
+		{
+			int running = DIAGRAM_IDLE;
+
+			if (core_job[i] != -1)
+			{
+				simulator_job_list_t *job = &jobs[job_index_get(job_slot, core_job[i])];
+				assert(job->core_id == i);
+
+				cores_working++;
+				job->run_time -= units;
+				running = job->job_id;
+			}
+
+			if (keep_diagram && diagram_append(core_timing_diagram, i, running, units) != 0)
+			{
+				fprintf(stderr, "Out of memory.\n");
+				return 3;
+			}
+		}
+
+		run->busy_units += (long long)cores_working * units;
+
+
+		/*
+		 * 5. Print data!
+		 */
+		if (!event_driven && verbosity >= VERBOSITY_TICKS)
+		{
+			printf("At the end of time unit %d...\n", time);
+
+			for (i = 0; i < cores; i++)
+			{
+				printf("  Core %2d: ", i);
+				diagram_print(core_timing_diagram, i, stdout);
+				printf("\n");
+			}
+
+			printf("\n");
+
+			printf("  Queue: ");
+			scheduler_show_queue_ctx(scheduler);
+			printf("\n");
+			printf("\n");
+		}
+
+
+		/*
+		 * 6. Sanity Checking
+		 *
+		 * - If there's a job alive (needing to be ran) and all CPUs are idle, the scheduler failed to schedule properly.
+		 */
+		if (jobs_alive > 0 && cores_working == 0)
+		{
+			fprintf(run->errors, "All cores are idle and at least one job remains unscheduled.\n");
+			print_available_jobs(run->errors, jobs, active_jobs);
+			return 3;
+		}
+
+
+		/*
+		 * 7. Increase time
+		 */
+		time += units;
+	}
+
+	run->time = time;
+	run->jobs_read = job_id;
+	return 0;
+}
+
+void simulate_destroy(simulator_run_t *run)
+{
+	scheduler_clean_up_ctx(&run->scheduler);
+	diagram_destroy(&run->diagram);
+
+	if (run->event_driven)
+	{
+		priqueue_destroy(&run->events);
+		free(run->core_events);
+		free(run->changed_cores);
+	}
+
+	free(run->quantum_timers);
+	job_index_destroy(&run->job_slot);
+	job_index_destroy(&run->loaded_slots);
+	job_index_destroy(&run->loaded_jobs);
+	free(run->core_job);
+	free(run->finished_slots);
+	free(run->expired_cores);
+	free(run->pending);
+	free(run->jobs);
+	free(run->batch);
+	free(run->decisions);
+}
+
+
+/*
+ * A parameter sweep (--sweep): every combination of the listed core counts
+ * and schemes is run over the same loaded trace, spread over a pool of
+ * threads that each take the next configuration until none are left.
+ */
+typedef struct _simulator_sweep_result_t
+{
+	int cores, scheme, quantum;
+	int status; // what simulate() returned
+	int time;
+	long long busy_units;
+	float waiting, turnaround, response;
+	long long waiting_p99, turnaround_p99, response_p99;
+	scheduler_stats_t stats;
+} simulator_sweep_result_t;
+
+typedef struct _simulator_sweep_t
+{
+	const trace_job_t *trace;
+	int trace_count;
+	int steal_threshold;
+	simulator_sweep_result_t *results;
+	int configs, next_config;
+	pthread_mutex_t lock;
+} simulator_sweep_t;
 
-void print_usage(char *program_name)
+/*
+ * Parses a comma separated list of positive numbers and first..last ranges,
+ * e.g. "1,2,4..8", appending them to values. Returns 0, or -1 when an entry
+ * is not a positive number or a range runs backwards.
+ */
+int parse_number_list(char *text, int **values, int *count)
 {
-	fprintf(stderr, "Usage: %s -c <cores> -s <scheme> <input file>\n", program_name);
-	fprintf(stderr, "       %s -c 2 -s fcfs examples/proc1.csv\n", program_name);
-	fprintf(stderr, "\n");
-	fprintf(stderr, "Acceptable schemes are: fcfs, sjf, psjf, pri, ppri, rr#\n");
+	char *item, *save;
+
+	for (item = strtok_r(text, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+	{
+		char *range = strstr(item, "..");
+		int first = atoi(item), last = first;
+
+		if (range != NULL)
+			last = atoi(range + 2);
+		if (first <= 0 || last < first)
+			return -1;
+
+		*values = realloc(*values, (*count + last - first + 1) * sizeof(int));
+		for (int value = first; value <= last; value++)
+			(*values)[(*count)++] = value;
+	}
+
+	return 0;
 }
 
-int set_active_job(int job_id, int core_id, simulator_job_list_t *jobs, int active_jobs)
+/*
+ * Parses a comma separated list of schemes as -s takes them, where RR may
+ * give a range of quanta, e.g. "fcfs,sjf,rr1..rr16" (or rr1..16). Returns 0,
+ * or -1 on a bad entry.
+ */
+int parse_scheme_list(char *text, int **schemes, int **quanta, int *count)
 {
-	int i;
-	for (i = 0; i < active_jobs; i++)
+	char *item, *save;
+
+	for (item = strtok_r(text, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
 	{
-		if (jobs[i].job_id == job_id && jobs[i].arrived)
+		char *range = strstr(item, "..");
+		int scheme, first, last;
+
+		if (range != NULL)
+			*range = '\0';
+		if (parse_scheme(item, &scheme, &first) != 0)
+			return -1;
+
+		last = first;
+		if (range != NULL)
 		{
-			jobs[i].core_id = core_id;
-			return 1;
+			range += 2;
+			if (strncasecmp(range, "RR", 2) == 0)
+				range += 2;
+			last = atoi(range);
+
+			if (scheme != RR || last < first)
+				return -1;
+		}
+
+		*schemes = realloc(*schemes, (*count + last - first + 1) * sizeof(int));
+		*quanta = realloc(*quanta, (*count + last - first + 1) * sizeof(int));
+		for (int quantum = first; quantum <= last; quantum++)
+		{
+			(*schemes)[*count] = scheme;
+			(*quanta)[(*count)++] = quantum;
 		}
 	}
 
 	return 0;
 }
 
-void print_available_jobs(simulator_job_list_t *jobs, int active_jobs)
+void *sweep_worker(void *arg)
 {
-	printf("Active jobs are: ");
+	simulator_sweep_t *sweep = arg;
 
-	int i, first = 1;
-	for (i = 0; i < active_jobs; i++)
+	while (1)
 	{
-		if (jobs[i].arrived)
+		pthread_mutex_lock(&sweep->lock);
+		int config = sweep->next_config++;
+		pthread_mutex_unlock(&sweep->lock);
+
+		if (config >= sweep->configs)
+			return NULL;
+
+		simulator_sweep_result_t *result = &sweep->results[config];
+		simulator_run_t run;
+		memset(&run, 0, sizeof(run));
+		run.cores = result->cores;
+		run.scheme = result->scheme;
+		run.quantum = result->quantum;
+		run.event_driven = 1;
+		run.verbosity = VERBOSITY_METRICS;
+		run.trace = sweep->trace;
+		run.trace_count = sweep->trace_count;
+		run.steal_threshold = sweep->steal_threshold;
+		run.errors = stderr; // stdout is the table
+
+		result->status = simulate(&run);
+		if (result->status == 0)
 		{
-			if (first)
-			{
-				printf("%d", jobs[i].job_id);
-				first = 0;
-			}
-			else
-				printf(", %d", jobs[i].job_id);
+			result->time = run.time;
+			result->busy_units = run.busy_units;
+			result->waiting = scheduler_average_waiting_time_ctx(&run.scheduler);
+			result->turnaround = scheduler_average_turnaround_time_ctx(&run.scheduler);
+			result->response = scheduler_average_response_time_ctx(&run.scheduler);
+			result->waiting_p99 = histogram_percentile(scheduler_histogram_ctx(&run.scheduler, SCHEDULER_WAITING_TIME), 99.0);
+			result->turnaround_p99 = histogram_percentile(scheduler_histogram_ctx(&run.scheduler, SCHEDULER_TURNAROUND_TIME), 99.0);
+			result->response_p99 = histogram_percentile(scheduler_histogram_ctx(&run.scheduler, SCHEDULER_RESPONSE_TIME), 99.0);
+			scheduler_stats_ctx(&run.scheduler, &result->stats);
 		}
-	}
 
-	if (!first)
-		printf("\n");
+		simulate_destroy(&run);
+	}
 }
 
-void print_available_cores(int cores)
+/*
+ * Runs every configuration of the sweep on threads threads and prints one CSV
+ * row per configuration, in the order they were listed: cores first, then
+ * schemes.
+ */
+int run_sweep(simulator_sweep_t *sweep, int threads)
 {
-	printf("Active cores are: ");
-
 	int i;
-	for (i = 0; i < cores; i++)
+
+	if (threads > sweep->configs)
+		threads = sweep->configs;
+
+	pthread_t *workers = malloc(threads * sizeof(pthread_t));
+	if (workers == NULL)
 	{
-		if (i == cores - 1)
-			printf("%d\n", i);
-		else
-			printf("%d, ", i);
+		fprintf(stderr, "Out of memory.\n");
+		return 2;
+	}
+
+	pthread_mutex_init(&sweep->lock, NULL);
+	sweep->next_config = 0;
+
+	int started = 0;
+	for (i = 0; i < threads; i++)
+		if (pthread_create(&workers[started], NULL, sweep_worker, sweep) == 0)
+			started++;
+
+	// With no thread at all, do the work here
+	if (started == 0)
+		sweep_worker(sweep);
+
+	for (i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+
+	pthread_mutex_destroy(&sweep->lock);
+	free(workers);
+
+	printf("cores,scheme,quantum,jobs,time,utilization,waiting,turnaround,response,waiting_p99,turnaround_p99,response_p99,steals,imbalance,max_imbalance,status\n");
+	for (i = 0; i < sweep->configs; i++)
+	{
+		simulator_sweep_result_t *result = &sweep->results[i];
+
+		if (result->status != 0)
+		{
+			printf("%d,%s,%d,%d,,,,,,,,,,,,failed\n", result->cores, scheme_name(result->scheme), result->quantum, sweep->trace_count);
+			continue;
+		}
+
+		double utilization = (result->time > 0) ? (double)result->busy_units / ((double)result->time * result->cores) : 0.0;
+		printf("%d,%s,%d,%d,%d,%.4f,%.2f,%.2f,%.2f,%lld,%lld,%lld,%lld,%.2f,%d,ok\n", result->cores, scheme_name(result->scheme), result->quantum,
+				sweep->trace_count, result->time, utilization, result->waiting, result->turnaround, result->response,
+				result->waiting_p99, result->turnaround_p99, result->response_p99, result->stats.steals, result->stats.averageImbalance, result->stats.maxImbalance);
 	}
+
+	return 0;
 }
 
 
 int main(int argc, char **argv)
 {
-	int c;
+	int c, i;
 	int cores = 0, scheme = -1, quantum = 0;
-	char *file_name;
+	int event_driven = 0, streaming = 0, sweep = 0, threads = 0, steal_threshold = 0, memory_stats = 0, percentiles = 0;
+	int verbosity = VERBOSITY_TICKS;
+	char *file_name, *segments_file_name = NULL;
+	char *cores_arg = NULL, *scheme_arg = NULL;
+
+	static struct option long_options[] =
+	{
+		{ "sweep", no_argument, NULL, 'W' },
+		{ NULL, 0, NULL, 0 }
+	};
 
 	/*
 	 * Parse command line options.
 	 */
-	while ((c = getopt(argc, argv, "c:s:")) != -1)
+	while ((c = getopt_long(argc, argv, "c:s:eqv:d:Sj:w:mp", long_options, NULL)) != -1)
 	{
 		switch (c)
 		{
-			case 'c':
-				cores = atoi(optarg);
+			case 'W':
+				sweep = 1;
+				break;
 
-				if (cores <= 0)
+			case 'j':
+				threads = atoi(optarg);
+
+				if (threads <= 0)
 				{
-					fprintf(stderr, "Option -c <cores> require a positive number.\n");
+					fprintf(stderr, "Option -j <threads> requires a positive number.\n");
 					print_usage(argv[0]);
 					return 1;
 				}
 				break;
 
-			case 's':
-				if (strcasecmp(optarg, "FCFS") == 0) { scheme = FCFS; }
-				else if (strcasecmp(optarg, "SJF") == 0) { scheme = SJF; }
-				else if (strcasecmp(optarg, "PSJF") == 0) { scheme = PSJF; }
-				else if (strcasecmp(optarg, "PRI") == 0) { scheme = PRI; }
-				else if (strcasecmp(optarg, "PPRI") == 0) { scheme = PPRI; }
-				else if (strncasecmp(optarg, "RR", 2) == 0)
+			case 'w':
+				steal_threshold = atoi(optarg);
+
+				if (steal_threshold <= 0)
 				{
-					scheme = RR;
-					quantum = atoi(optarg + 2);
+					fprintf(stderr, "Option -w <threshold> requires a positive number.\n");
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
 
-					if (quantum <= 0)
-					{
-						fprintf(stderr, "Option -s <scheme> requires a positive number for the quantum of RR. (Eg: -s RR2)\n");
-						print_usage(argv[0]);
-						return 1;
-					}
+			case 'd':
+				segments_file_name = optarg;
+				break;
+
+			case 'S':
+				streaming = 1;
+				break;
+
+			case 'm':
+				memory_stats = 1;
+				break;
+
+			case 'p':
+				percentiles = 1;
+				break;
+
+			case 'e':
+				event_driven = 1;
+				break;
+
+			case 'q':
+				verbosity = VERBOSITY_METRICS;
+				break;
+
+			case 'v':
+				verbosity = atoi(optarg);
+
+				if (verbosity < VERBOSITY_METRICS || verbosity > VERBOSITY_TICKS || optarg[0] < '0' || optarg[0] > '9')
+				{
+					fprintf(stderr, "Option -v <level> requires a level from %d to %d.\n", VERBOSITY_METRICS, VERBOSITY_TICKS);
+					print_usage(argv[0]);
+					return 1;
 				}
 				break;
 
+			case 'c':
+				cores_arg = optarg;
+				break;
+
+			case 's':
+				scheme_arg = optarg;
+				break;
+
 			case '?':
 				print_usage(argv[0]);
 				return 1;
@@ -133,14 +1480,33 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (cores == 0)
+	if (cores_arg == NULL)
 	{
 		fprintf(stderr, "Required option -c <cores> is not present.\n");
 		print_usage(argv[0]);
 		return 1;
 	}
 
-	if (scheme == -1)
+	if (!sweep)
+	{
+		cores = atoi(cores_arg);
+
+		if (cores <= 0)
+		{
+			fprintf(stderr, "Option -c <cores> require a positive number.\n");
+			print_usage(argv[0]);
+			return 1;
+		}
+
+		if (scheme_arg != NULL && parse_scheme(scheme_arg, &scheme, &quantum) == -2)
+		{
+			fprintf(stderr, "Option -s <scheme> requires a positive number for the quantum of RR. (Eg: -s RR2)\n");
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (scheme_arg == NULL || (!sweep && scheme == -1))
 	{
 		fprintf(stderr, "Required option -s <scheme> is not present.\n");
 		print_usage(argv[0]);
@@ -156,337 +1522,200 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	if (sweep && (streaming || segments_file_name != NULL))
+	{
+		fprintf(stderr, "Options -S and -d cannot be used with --sweep.\n");
+		print_usage(argv[0]);
+		return 1;
+	}
+
 
 	/*
 	 * Open the file, read the file, and populate the jobs data structure.
 	 */
-	FILE *file = fopen(file_name, "r");
-	if (file == NULL)
-	{
-		fprintf(stderr, "Unable to open file \"%s\".\n", file_name);
-		return 2;
-	}
+	trace_job_t *trace = NULL;
+	trace_error_t trace_error;
+	int job_count = 0, result;
 
+	simulator_run_t run;
+	memset(&run, 0, sizeof(run));
 
-	int job_id = 0;
-	int jobs_ct = 10;
-	simulator_job_list_t* jobs = malloc(jobs_ct * sizeof(simulator_job_list_t));
+	trace_reader_t reader;
+	FILE *stream_file = NULL;
 
-	char line[1024 + 1];
-	fgets(line, 1024, file);  // Ignore the first (header) line
-	while (fgets(line, 1024, file) != NULL)
+	if (streaming)
 	{
-		char *arrival_time = strtok(line, ",");
-		char *run_time = strtok(NULL, ",");
-		char *priority = strtok(NULL, ",");
-
-		if (arrival_time != NULL && run_time != NULL && priority != NULL)
-		{
-			if (job_id == jobs_ct)
-			{
-				jobs_ct *= 2;
-				jobs = realloc(jobs, jobs_ct * sizeof(simulator_job_list_t));
-
-				if (!jobs)
-				{
-					fprintf(stderr, "Out of memory.\n");
-					return 2;
-				}
-			}
-
-			jobs[job_id].job_id = job_id;
-			jobs[job_id].arrival_time = atoi(arrival_time);
-			jobs[job_id].run_time = atoi(run_time);
-			jobs[job_id].priority = atoi(priority);
-			jobs[job_id].core_id = -1;
-			jobs[job_id].arrived = 0;
+		if (open_stream(&reader, file_name, &stream_file, &run.stream_count) != 0)
+			return 2;
 
-			job_id++;
-		}
-		else
-		{
-			fprintf(stderr, "Illegal file format.\n");
+		run.reader = &reader;
+		run.next_job.arrival_time = INT_MIN;
+		if ((run.stream_pending = stream_next_job(&reader, file_name, &run.next_job)) < 0)
 			return 2;
-		}
 	}
-
-	fclose(file);
+	else if ((result = trace_load(file_name, &trace, &job_count, &trace_error)) != TRACE_OK)
+	{
+		print_trace_error(file_name, result, &trace_error);
+		return 2;
+	}
 
 
 	/*
-	 * Run the simulation.
+	 * Run the simulation. Output goes through one large buffer written out in
+	 * big chunks rather than a line or a few KB at a time.
 	 */
+	char *output_buffer = malloc(OUTPUT_BUFFER_SIZE);
+	if (output_buffer != NULL)
+		setvbuf(stdout, output_buffer, _IOFBF, OUTPUT_BUFFER_SIZE);
 
-	printf("Loaded %d core(s) and %d job(s) using ", cores, job_id);
-	if (scheme == FCFS) { printf("First Come First Served (FCFS)"); }
-	else if (scheme == SJF) { printf("Non-preemptive Shortest Job First (SJF)"); }
-	else if (scheme == PSJF) { printf("Preemptive Shortest Job First (PSJF)"); }
-	else if (scheme == PRI) { printf("Non-preemptive Priority (PRI)"); }
-	else if (scheme == PPRI) { printf("Preemptive Priority (PPRI)"); }
-	else if (scheme == RR) { printf("Round Robin (RR) with a quantum of %d", quantum); }
-	printf(" scheduling...\n\n");
-
-	scheduler_start_up(cores, scheme);
-
-
-	int time = 0, i, j;
-	int active_jobs = job_id, jobs_alive = 0;
-
-	int *quantum_clock = malloc(cores * sizeof(int));
-	char **core_timing_diagram = malloc(cores * sizeof(char *));
-	int core_timing_diagram_size = 1024;
-
-	for (i = 0; i < cores; i++)
-	{
-		quantum_clock[i] = -1;
-		core_timing_diagram[i] = malloc(core_timing_diagram_size + 1);
-		core_timing_diagram[i][0] = '\0';
-	}
-
-	while (active_jobs > 0)
+	if (sweep)
 	{
-		printf("=== [TIME %d] ===\n", time);
+		int *core_list = NULL, *scheme_list = NULL, *quantum_list = NULL;
+		int core_count = 0, scheme_count = 0;
 
-		/*
-		 * 1. Check if any jobs finished in the last time unit.
-		 */
-		for (i = 0; i < active_jobs; i++)
+		if (parse_number_list(cores_arg, &core_list, &core_count) != 0 || core_count == 0)
 		{
-			if (jobs[i].run_time == 0)
-			{
-				// Notify the scheduler has finished
-				int job_id = jobs[i].job_id;
-				int core_id = jobs[i].core_id;
-				int new_job_id = scheduler_job_finished(jobs[i].core_id, jobs[i].job_id, time);
-
-				if (scheme == RR)
-					quantum_clock[jobs[i].core_id] = quantum;
-
-				// Delete the finished jobs, decrease the number of active jobs
-				if (i != active_jobs - 1)
-					memcpy(&jobs[i], &jobs[active_jobs - 1], sizeof(simulator_job_list_t));
-				active_jobs--;
-				jobs_alive--;
-				i--;
-
-				// Set the new job
-				if ( new_job_id != -1 && !set_active_job(new_job_id, core_id, jobs, active_jobs) )
-				{
-					printf("The scheduler_job_finished() selected an invalid job (job_id == %d).\n", new_job_id);
-					print_available_jobs(jobs, active_jobs);
-					return 3;
-				}
-				else
-				{
-					printf("Job %d, running on core %d, finished. Core %d is now running job %d.\n", job_id, core_id, core_id, new_job_id);
-					printf("  Queue: "); scheduler_show_queue(); printf("\n\n");
-				}
-			}
+			fprintf(stderr, "Option -c <cores> requires a list of positive numbers with --sweep. (Eg: -c 1,2,4..8)\n");
+			print_usage(argv[0]);
+			return 1;
 		}
 
-		/*
-		 * Check to see if we finished our last job.  (If we don't check here, we would run an extra time unit that will be totally idle.)
-		 */
-		if (active_jobs == 0)
-			break;
-
-		/*
-		 * 2. Check of any quantums expired in the last time unit.
-		 */
-		if (scheme == RR)
+		if (parse_scheme_list(scheme_arg, &scheme_list, &quantum_list, &scheme_count) != 0 || scheme_count == 0)
 		{
-			for (i = 0; i < cores; i++)
-			{
-				if (quantum_clock[i] == 0)
-				{
-					for (j = 0; j < active_jobs; j++)
-					{
-						if (jobs[j].core_id == i)
-						{
-							// Notify the scheduler the quantum has expired
-							int core_id = jobs[j].core_id;
-							int old_job_id = jobs[j].job_id;
-							int new_job_id = scheduler_quantum_expired(jobs[j].core_id, time);
-
-							jobs[j].core_id = -1;
-
-							quantum_clock[core_id] = quantum;
-
-							// Set the new job
-							if ( new_job_id != -1 && !set_active_job(new_job_id, core_id, jobs, active_jobs) )
-							{
-								printf("The scheduler_quantum_expired() selected an invalid job (job_id == %d).\n", new_job_id);
-								print_available_jobs(jobs, active_jobs);
-								return 3;
-							}
-							else
-							{
-								printf("Job %d, running on core %d, had its quantum expire. Core %d is now running job %d.\n", old_job_id, core_id, core_id, new_job_id);
-								printf("  Queue: "); scheduler_show_queue(); printf("\n\n");
-							}
-
-							break;
-						}
-					}
-				}
-			}
+			fprintf(stderr, "Option -s <scheme> requires a list of schemes with --sweep. (Eg: -s fcfs,sjf,rr1..rr16)\n");
+			print_usage(argv[0]);
+			return 1;
 		}
 
-
-		/*
-		 * 3. Check for any new jobs that arrive in this time unit
-		 */
-		for (i = 0; i < active_jobs; i++)
+		simulator_sweep_t plan;
+		plan.trace = trace;
+		plan.trace_count = job_count;
+		plan.steal_threshold = steal_threshold;
+		plan.configs = core_count * scheme_count;
+		plan.results = calloc(plan.configs, sizeof(simulator_sweep_result_t));
+		if (plan.results == NULL)
 		{
-			if (jobs[i].arrival_time == time)
-			{
-				int new_job_core_id = scheduler_new_job(jobs[i].job_id, time, jobs[i].run_time, jobs[i].priority);
-				jobs[i].arrived = 1;
-				jobs_alive++;
-
-				if (new_job_core_id >= 0 && new_job_core_id < cores)
-				{
-					printf("A new job, job %d (running time=%d, priority=%d), arrived. Job %d is now running on core %d.\n",
-							jobs[i].job_id, jobs[i].run_time, jobs[i].priority, jobs[i].job_id, new_job_core_id);
-					printf("  Queue: "); scheduler_show_queue(); printf("\n\n");
-
-					// Find if anyone is currently using the core.
-					for (j = 0; j < active_jobs; j++)
-						if (jobs[j].core_id == new_job_core_id)
-							jobs[j].core_id = -1;
-
-					// Assign the core to the new job
-					jobs[i].core_id = new_job_core_id;
-
-					if (scheme == RR)
-						quantum_clock[new_job_core_id] = quantum;
-				}
-				else if (new_job_core_id == -1)
-				{
-					printf("A new job, job %d (running time=%d, priority=%d), arrived. Job %d is set to idle (-1).\n",
-							jobs[i].job_id, jobs[i].run_time, jobs[i].priority, jobs[i].job_id);
-					printf("  Queue: "); scheduler_show_queue(); printf("\n\n");
-				}
-				else
-				{
-					printf("The scheduler_new_job() selected an invalid core (core_id == %d).\n", new_job_core_id);
-					print_available_cores(cores);
-					return 3;
-				}
-			}
+			fprintf(stderr, "Out of memory.\n");
+			return 2;
 		}
 
-
-		/*
-		 * 4. Run the time unit.
-		 */
-		char time_string[cores][11];
-		int cores_working = 0;
-
-		for (i = 0; i < cores; i++)
-			time_string[i][0] = '\0';
-
-		for (i = 0; i < active_jobs; i++)
+		for (i = 0; i < plan.configs; i++)
 		{
-			if (jobs[i].core_id != -1)
-			{
-				cores_working++;
-				jobs[i].run_time--;
-				quantum_clock[jobs[i].core_id]--;
-
-				assert(time_string[jobs[i].core_id][0] == '\0');
-
-				if (jobs[i].job_id < 10)
-					sprintf(time_string[jobs[i].core_id], "%d", jobs[i].job_id);
-				else if (jobs[i].job_id < 10 + 26)
-					sprintf(time_string[jobs[i].core_id], "%c", jobs[i].job_id - 10 + 'a');
-				else if (jobs[i].job_id < 10 + 26 + 26)
-					sprintf(time_string[jobs[i].core_id], "%c", jobs[i].job_id - 10 - 26 + 'A');
-				else
-					snprintf(time_string[jobs[i].core_id], 10, "(%d)", jobs[i].job_id);
-			}
+			plan.results[i].cores = core_list[i / scheme_count];
+			plan.results[i].scheme = scheme_list[i % scheme_count];
+			plan.results[i].quantum = quantum_list[i % scheme_count];
 		}
 
-		for (i = 0; i < cores; i++)
-		{
-			// If the core is idle, print a '-'
-			if (time_string[i][0] == '\0')
-				strcpy(time_string[i], "-");
-
-			// Ensure we have enough memory
-			while (strlen(core_timing_diagram[i]) + strlen(time_string[i]) >= (unsigned int)core_timing_diagram_size)
-			{
-				core_timing_diagram_size *= 2;
-
-				for (j = 0; j < cores; j++)
-				{
-					core_timing_diagram[j] = realloc(core_timing_diagram[j], core_timing_diagram_size + 1);
+		if (threads == 0)
+			threads = (sysconf(_SC_NPROCESSORS_ONLN) > 0) ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
 
-					if (core_timing_diagram[j] == NULL)
-					{
-						fprintf(stderr, "Out of memory.\n");
-						return 3;
-					}
-				}
-			}
+		result = run_sweep(&plan, threads);
 
-			strcat( core_timing_diagram[i], time_string[i] );
-		}
+		free(plan.results);
+		free(core_list);
+		free(scheme_list);
+		free(quantum_list);
+		free(trace);
 
+		fflush(stdout);
+		setvbuf(stdout, NULL, _IONBF, 0);
+		free(output_buffer);
 
-		/*
-		 * 5. Print data!
-		 */
-		printf("At the end of time unit %d...\n", time);
+		return result;
+	}
 
-		for (i = 0; i < cores; i++)
-			printf("  Core %2d: %s\n", i, core_timing_diagram[i]);
+	if (verbosity >= VERBOSITY_SUMMARY)
+	{
+		if (streaming)
+			printf("Loaded %d core(s) and streaming the jobs using ", cores);
+		else
+			printf("Loaded %d core(s) and %d job(s) using ", cores, job_count);
+		if (scheme == FCFS) { printf("First Come First Served (FCFS)"); }
+		else if (scheme == SJF) { printf("Non-preemptive Shortest Job First (SJF)"); }
+		else if (scheme == PSJF) { printf("Preemptive Shortest Job First (PSJF)"); }
+		else if (scheme == PRI) { printf("Non-preemptive Priority (PRI)"); }
+		else if (scheme == PPRI) { printf("Preemptive Priority (PPRI)"); }
+		else if (scheme == RR) { printf("Round Robin (RR) with a quantum of %d", quantum); }
+		printf(" scheduling...\n\n");
+	}
 
-		printf("\n");
+	run.cores = cores;
+	run.scheme = scheme;
+	run.quantum = quantum;
+	run.event_driven = event_driven;
+	run.verbosity = verbosity;
+	run.keep_diagram = (verbosity >= VERBOSITY_SUMMARY || segments_file_name != NULL);
+	run.steal_threshold = steal_threshold;
+	run.errors = stdout;
+	run.trace = trace;
+	run.trace_count = job_count;
+	run.file_name = file_name;
 
-		printf("  Queue: ");
-		scheduler_show_queue();
-		printf("\n");
-		printf("\n");
+	if ((result = simulate(&run)) != 0)
+		return result;
 
 
-		/*
-		 * 6. Sanity Checking
-		 *
-		 * - If there's a job alive (needing to be ran) and all CPUs are idle, the scheduler failed to schedule properly.
-		 */
-		if (jobs_alive > 0 && cores_working == 0)
+	if (verbosity >= VERBOSITY_SUMMARY)
+	{
+		printf("FINAL TIMING DIAGRAM:\n");
+		for (i = 0; i < cores; i++)
 		{
-			printf("All cores are idle and at least one job remains unscheduled.\n");
-			print_available_jobs(jobs, active_jobs);
-			return 3;
+			printf("  Core %2d: ", i);
+			diagram_print(&run.diagram, i, stdout);
+			printf("\n");
 		}
 
-
-		/*
-		 * 7. Increase time
-		 */
-		time++;
+		printf("\n");
 	}
 
+	scheduler_stats_t stats;
+	scheduler_stats_ctx(&run.scheduler, &stats);
+	if (steal_threshold > 0)
+	{
+		printf("Steals: %lld\n", stats.steals);
+		printf("Run Queue Imbalance: %.2f average, %d max\n", stats.averageImbalance, stats.maxImbalance);
+	}
+	if (memory_stats)
+	{
+		printf("Job Records: %d bytes each, %d live at most, %d allocated in %d chunks (%lld bytes)\n",
+			stats.jobBytes, stats.jobsHighWater, stats.jobsCapacity, stats.jobChunks, (long long)stats.jobsCapacity * stats.jobBytes);
+	}
+	if (percentiles)
+	{
+		print_percentiles("Waiting", scheduler_histogram_ctx(&run.scheduler, SCHEDULER_WAITING_TIME));
+		print_percentiles("Turnaround", scheduler_histogram_ctx(&run.scheduler, SCHEDULER_TURNAROUND_TIME));
+		print_percentiles("Response", scheduler_histogram_ctx(&run.scheduler, SCHEDULER_RESPONSE_TIME));
+	}
+	printf("Average Waiting Time: %.2f\n", scheduler_average_waiting_time_ctx(&run.scheduler));
+	printf("Average Turnaround Time: %.2f\n", scheduler_average_turnaround_time_ctx(&run.scheduler));
+	printf("Average Response Time: %.2f\n", scheduler_average_response_time_ctx(&run.scheduler));
 
-	printf("FINAL TIMING DIAGRAM:\n");
-	for (i = 0; i < cores; i++)
-		printf("  Core %2d: %s\n", i, core_timing_diagram[i]);
+	if (segments_file_name != NULL)
+	{
+		FILE *segments_file = fopen(segments_file_name, "w");
+		if (segments_file == NULL)
+		{
+			fprintf(stderr, "Unable to open file \"%s\".\n", segments_file_name);
+			return 2;
+		}
 
-	printf("\n");
-	printf("Average Waiting Time: %.2f\n", scheduler_average_waiting_time());
-	printf("Average Turnaround Time: %.2f\n", scheduler_average_turnaround_time());
-	printf("Average Response Time: %.2f\n", scheduler_average_response_time());
+		diagram_dump(&run.diagram, segments_file);
+		fclose(segments_file);
+	}
 
-	scheduler_clean_up();
+	simulate_destroy(&run);
+	free(trace);
 
+	if (streaming)
+	{
+		trace_reader_close(&reader);
+		if (stream_file != stdin)
+			fclose(stream_file);
+	}
 
-	free(quantum_clock);
-	for (i=0; i < cores; i++)
-		free(core_timing_diagram[i]);
-	free(core_timing_diagram);
-	free(jobs);
+	fflush(stdout);
+	setvbuf(stdout, NULL, _IONBF, 0);
+	free(output_buffer);
 
 	return 0;
 }